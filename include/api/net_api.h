@@ -37,6 +37,7 @@ const char * x_inet_ntop(int family, const void *addrptr, char *strptr, size_t l
 #define sendto(s, buf, len, flags, dest, dlen)      x_sendto(s, buf, len, flags, dest, dlen)
 #define recvfrom(s, buf, len, flags, src, slen)     x_recvfrom(s, buf, len, flags, src, slen)
 #define setsockopt(s, level, optname, optval, len)  x_setsockopt(s, level, optname, optval, len)
+#define getsockopt(s, level, optname, optval, len)  x_getsockopt(s, level, optname, optval, len)
 #define close(s)                                    x_close(s)
 #define connect(s, addr, len)                       x_connect(s, addr, len)
 #define send(s, buf, len, flags)                    x_send(s, buf, len, flags)
@@ -28,6 +28,9 @@ void sock_wait_leave (sock_wait_t * wait, net_err_t err);
 
 struct _sock_t;
 struct x_sockaddr;
+struct x_tcp_info;
+struct x_mmsghdr;
+struct x_iovec;
 
 typedef int x_socklen_t;
 
@@ -41,6 +44,7 @@ typedef struct _sock_ops_t {
     net_err_t(*recvfrom)(struct _sock_t* s, void* buf, size_t len, int flags,
                          struct x_sockaddr* src, x_socklen_t * addr_len, ssize_t * result_len);
     net_err_t (*setopt)(struct _sock_t* s,  int level, int optname, const char * optval, int optlen);
+    net_err_t (*getopt)(struct _sock_t* s,  int level, int optname, char * optval, int * optlen);
     void (*destroy)(struct _sock_t *s);
     net_err_t (*connect)(struct _sock_t* s, const struct x_sockaddr* addr, x_socklen_t len);
     net_err_t(*send)(struct _sock_t* s, const void* buf, size_t len, int flags, ssize_t * result_len);
@@ -64,6 +68,7 @@ typedef struct _sock_t {
     int err;						// err code of last operation
     int rcv_tmo;					// ms
     int snd_tmo;					// ms
+    int reuseport;                  // SO_REUSEPORT
     sock_wait_t * snd_wait;
     sock_wait_t * rcv_wait;
     sock_wait_t * conn_wait;
@@ -103,6 +108,13 @@ typedef struct _sock_opt_t {
     int optlen;
 }sock_opt_t;
 
+typedef struct _sock_getopt_t {
+    int level;
+    int optname;
+    char * optval;
+    int * optlen;                   // in: size of optval, out: size written
+}sock_getopt_t;
+
 typedef struct _sock_bind_t {
     const struct x_sockaddr* addr;
     x_socklen_t len;
@@ -119,6 +131,43 @@ typedef struct _sock_accept_t {
     int client;  // sockfd of the new client
 }sock_accept_t;
 
+// req for a vector of datagrams
+typedef struct _sock_mmsg_t {
+    struct x_mmsghdr * vec;
+    int vlen;
+    int flags;
+    int comp_cnt;                   // datagrams completed, kept across waits
+}sock_mmsg_t;
+
+// req for borrowing a received datagram without copying
+typedef struct _sock_borrow_t {
+    struct x_iovec * iov;
+    int * iovcnt;                   // in: capacity of iov, out: pieces filled or needed
+    struct x_sockaddr* addr;
+    x_socklen_t * addr_len;
+    ssize_t comp_len;               // size of the datagram
+    void * handle;                  // give it back with x_recv_release()
+}sock_borrow_t;
+
+// req for giving back borrowed datagrams
+typedef struct _sock_release_t {
+    void ** handles;
+    int cnt;
+}sock_release_t;
+
+// req for moving data from sockfd to out_fd
+typedef struct _sock_splice_t {
+    int out_fd;
+    size_t len;
+    ssize_t comp_len;               // bytes actually moved
+}sock_splice_t;
+
+// req for collecting statistics of all tcp connections
+typedef struct _sock_info_t {
+    struct x_tcp_info * info;
+    int cnt;                        // in: capacity of info, out: entries filled
+}sock_info_t;
+
 
 
 /**
@@ -133,6 +182,12 @@ typedef struct _sock_req_t {
         sock_create_t create;
         sock_data_t data;
         sock_opt_t opt;
+        sock_getopt_t getopt;
+        sock_info_t info;
+        sock_splice_t splice;
+        sock_mmsg_t mmsg;
+        sock_borrow_t borrow;
+        sock_release_t release;
         sock_conn_t conn;
         sock_bind_t bind;
         sock_listen_t listen;
@@ -161,7 +216,16 @@ net_err_t sock_recv (struct _sock_t * sock, void* buf, size_t len, int flags, ss
 void sock_uninit (sock_t * sock);
 net_err_t sock_setsockopt_req_in(func_msg_t * api_msg);
 net_err_t sock_setopt(struct _sock_t* s,  int level, int optname, const char * optval, int optlen);
+net_err_t sock_getsockopt_req_in(func_msg_t * api_msg);
+net_err_t sock_getopt(struct _sock_t* s,  int level, int optname, char * optval, int * optlen);
+net_err_t sock_tcp_info_req_in(func_msg_t * api_msg);
+net_err_t sock_splice_req_in(func_msg_t * api_msg);
+net_err_t sock_sendmmsg_req_in(func_msg_t * api_msg);
+net_err_t sock_recvmmsg_req_in(func_msg_t * api_msg);
+net_err_t sock_recv_borrow_req_in(func_msg_t * api_msg);
+net_err_t sock_recv_release_req_in(func_msg_t * api_msg);
 void sock_wakeup (sock_t * sock, int type, int err);
+uint32_t sock_flow_hash (const ipaddr_t * local_ip, uint16_t local_port, const ipaddr_t * remote_ip, uint16_t remote_port);
 net_err_t sock_bind(sock_t* sock, const struct x_sockaddr* addr, x_socklen_t len);
 
 #endif //EASY_NET_SOCK_H
@@ -13,10 +13,17 @@ int x_socket(int family, int type, int protocol);
 ssize_t x_sendto(int sid, const void* buf, size_t len, int flags, const struct x_sockaddr* dest, x_socklen_t dest_len);
 ssize_t x_recvfrom(int sid, void* buf, size_t len, int flags, struct x_sockaddr* src, x_socklen_t* src_len);
 int x_setsockopt(int sockfd, int level, int optname, const char * optval, int optlen);
+int x_getsockopt(int sockfd, int level, int optname, char * optval, int * optlen);
 int x_close(int sockfd);
 int x_connect(int sid, const struct x_sockaddr* addr, x_socklen_t len);
 ssize_t x_send(int fd, const void* buf, size_t len, int flags);
 ssize_t x_recv(int fd, void* buf, size_t len, int flags);
+ssize_t x_splice(int in_fd, int out_fd, size_t len);
+int x_sendmmsg(int sockfd, struct x_mmsghdr * msgvec, int vlen, int flags);
+int x_recvmmsg(int sockfd, struct x_mmsghdr * msgvec, int vlen, int flags);
+ssize_t x_recvfrom_zc(int sockfd, struct x_iovec * iov, int * iovcnt,
+                      struct x_sockaddr* src, x_socklen_t* src_len, void ** handle);
+int x_recv_release(int sockfd, void ** handles, int cnt);
 int x_bind(int sid, const struct x_sockaddr* addr, x_socklen_t len);
 int x_listen(int sockfd, int backlog);
 int x_accept(int sockfd, struct x_sockaddr* addr, x_socklen_t* len);
@@ -40,6 +47,8 @@ int x_accept(int sockfd, struct x_sockaddr* addr, x_socklen_t* len);
 #define SOL_SOCKET              0
 #undef SOL_TCP
 #define SOL_TCP                 1
+#undef SOL_UDP
+#define SOL_UDP                 2
 
 
 // sockopt name
@@ -55,6 +64,23 @@ int x_accept(int sockfd, struct x_sockaddr* addr, x_socklen_t* len);
 #define TCP_KEEPINTVL           5           // timout interval
 #undef TCP_KEEPCNT
 #define TCP_KEEPCNT             6           // retry count
+#undef TCP_INFO
+#define TCP_INFO                7           // per-connection statistics, struct x_tcp_info
+#undef TCP_ZEROCOPY_DONE
+#define TCP_ZEROCOPY_DONE       8           // completed MSG_ZEROCOPY sends, see struct x_zc_done
+#undef UDP_SEGMENT
+#define UDP_SEGMENT             9           // split each send into datagrams of this size, 0: off
+#undef UDP_GRO
+#define UDP_GRO                 10          // coalesce received datagrams of the same flow
+#undef SO_RCVBUF
+#define SO_RCVBUF               11          // receive buffer size in bytes, counted on memory used
+#undef UDP_STATS
+#define UDP_STATS               12          // receive statistics, struct x_udp_stats
+#undef SO_REUSEPORT
+#define SO_REUSEPORT            13          // share the local port with other sockets that also set it
+
+#undef MSG_ZEROCOPY
+#define MSG_ZEROCOPY            0x4000000   // send without copying, buffer is in use until completion
 
 #pragma pack(1)
 /**
@@ -106,6 +132,88 @@ struct x_timeval {
     int tv_usec;            // microseconds
 };
 
+/**
+ * a contiguous piece of a datagram, see x_recvfrom_zc()
+ */
+struct x_iovec {
+    const void * iov_base;
+    size_t iov_len;
+};
+
+/**
+ * one datagram of x_sendmmsg() / x_recvmmsg()
+ */
+struct x_mmsghdr {
+    void * buf;
+    size_t len;                     // size of buf
+    struct x_sockaddr * addr;       // send: destination, 0 for connected socket. recv: source, can be 0
+    x_socklen_t addr_len;
+    ssize_t msg_len;                // bytes sent or received
+    int seg_size;                   // recv: size of each coalesced datagram (UDP_GRO), 0: not coalesced
+};
+
+/**
+ * snapshot of a tcp connection, returned by getsockopt(SOL_TCP, TCP_INFO)
+ * and by x_tcp_info_list() for all connections.
+ * all times are in milliseconds.
+ */
+struct x_tcp_info {
+    int state;                      // tcp_state_t
+    struct x_in_addr local_addr;
+    struct x_in_addr remote_addr;
+    uint16_t local_port;
+    uint16_t remote_port;
+
+    int rto;                        // current retransmission timeout
+    int srtt;                       // smoothed rtt, 0 if no sample yet
+    int rttvar;                     // rtt variation
+    int snd_cwnd;                   // congestion window, 0: no congestion control
+    int snd_ssthresh;               // slow start threshold, 0: no congestion control
+    int snd_wnd;                    // last window advertised by peer
+    int rcv_wnd;                    // window we are advertising
+    int mss;
+
+    uint64_t bytes_acked;           // bytes sent and acked by peer
+    uint64_t bytes_received;        // bytes delivered to the receive buffer
+    int unacked;                    // bytes in flight (snd.nxt - snd.una)
+    int retransmits;                // retries of the current rexmit round
+    int total_retrans;              // segments retransmitted since creation, on timeouts and fast retransmits
+    int dup_acks;                   // duplicate acks received
+    int ooo_drops;                  // out-of-order segments dropped, there is no reassembly queue yet
+
+    int snd_buf_used;
+    int snd_buf_size;
+    int rcv_buf_used;
+    int rcv_buf_size;
+};
+
+/**
+ * receive statistics of a udp socket, returned by getsockopt(SOL_UDP, UDP_STATS)
+ */
+struct x_udp_stats {
+    uint64_t rcv_packets;           // datagrams queued
+    uint64_t rcv_bytes;             // payload bytes queued
+    uint32_t rcv_errors;            // datagrams dropped for bad checksum or length
+    uint32_t rcv_buf_drops;         // datagrams dropped because SO_RCVBUF is full
+    int rcv_used;                   // memory used by queued datagrams, in bytes
+    int rcvbuf;                     // SO_RCVBUF
+};
+
+/**
+ * each MSG_ZEROCOPY send on a tcp socket gets an id, counting from 0.
+ * getsockopt(SOL_TCP, TCP_ZEROCOPY_DONE) returns the ids completed since the last call,
+ * the buffers of these sends have been acked, no packet of the stack references them any more,
+ * and they can be reused. Sends are completed in the order of their ids.
+ */
+struct x_zc_done {
+    uint32_t lo;                    // id of the first completed send
+    uint32_t hi;                    // id of the last completed send
+    int cnt;                        // number of completed sends, 0: none
+};
+
+int x_tcp_info_list(struct x_tcp_info * info, int cnt);
+void x_tcp_dump(void);
+
 
 typedef struct _socket_t {
     enum {
@@ -25,12 +25,22 @@
  * Properties of the network stack.
  * */
 #define NET_ENDIAN_LITTLE           1
+#define NET_CHECKSUM_SIMD           1           // use the SSE2/AVX2 checksum kernels when the cpu has them
 
 #define HANDLER_BUFFER_SIZE         10			// size of the message buffer for the handler thread
 #define HANDLER_LOCK_TYPE           LOCKER_THREAD  // type of locker for the handler thread
-#define PACKET_PAGE_SIZE           128        // size of each page in a packet
-#define PACKET_PAGE_CNT            512         // size of the page memory pool
+#define PACKET_PAGE_SIZE           128        // size of each small page in a packet
+#define PACKET_PAGE_CNT            512         // size of the small page memory pool
+#define PACKET_PAGE_MID_SIZE       2048       // size of each mid page, holds a whole ethernet frame
+#define PACKET_PAGE_MID_CNT        64         // size of the mid page memory pool
+#define PACKET_PAGE_BIG_SIZE       9216       // size of each big page, holds a jumbo frame
+#define PACKET_PAGE_BIG_CNT        8          // size of the big page memory pool
 #define PACKET_BUFFER_SIZE         256       // size of the packer buffer memory pool
+#define LF_CACHE_SIZE              16        // blocks in each per-thread magazine of pages and packets
+#define LF_CACHE_SHARE             8         // a magazine keeps at most 1 / LF_CACHE_SHARE of the blocks of its pool
+#define LF_CACHE_PUBLISH           65536     // hits a magazine counts before adding them to the pool
+#define MEM_POOL_GROW_MIN          16        // fewest blocks added at a time to a pool growing from its arena
+#define NET_HUGE_PAGES             0         // NET_HUGE_xxx of net_config.h, pools in huge pages by default
 
 #define TIMER_SCAN_PERIOD           500         // period of timer scan
 
@@ -45,6 +55,8 @@
 #define ETHER_MTU                  1500                // maximum transmission unit
 #define ETH_HWA_SIZE               6                   // hardware address size for ethernet
 #define ETHER_MIN_PAYLOAD          46                  // minimum payload size for ethernet
+#define NETIF_HEADROOM             14                  // room kept for the link header of outgoing packets
+#define NETIF_PCAP_ZERO_COPY       0                   // 1: lend the pcap buffer to the stack instead of copying frames
 
 
 /**
@@ -67,6 +79,7 @@
 /**
 * Socket properties.
 */
+#define SOCKET_MAX_NR            10                 // maximum number of sockets
 #define RAW_MAX_NR               100                // maximum number of raw sockets
 #define RAW_MAX_RECV             50                 // raw socket receive buffer size
 #define NET_PORT_DYN_START       1024               // start of dynamic port range
@@ -77,7 +90,9 @@
  * UDP properties.
  * */
 #define UDP_MAX_NR               50                // maximum number of udp sockets
-#define UDP_MAX_RECV             1024                // maximum receive buffer of a udp socket
+#define UDP_RCVBUF_SIZE          (32 * 1024)        // default receive buffer of a udp socket, in bytes of memory used
+#define UDP_HASH_SIZE            64                // buckets of each udp lookup table
+#define UDP_MAX_SEGS             64                // maximum number of datagrams of one UDP_SEGMENT send
 
 
 
@@ -96,5 +111,7 @@
 #define TCP_INIT_RTO                    1000         // initial retransmission timeout, in milliseconds
 #define TCP_INT_RETRIES                 5            // number of retransmission retries
 #define TCP_RTO_MAX                     8000         // maximum retransmission timeout, in milliseconds
+#define TCP_ZC_MAX_NR                   16           // maximum number of pending MSG_ZEROCOPY sends of a tcp socket
+#define TCP_ZC_POLL_TMO                 10           // period of checking acked MSG_ZEROCOPY sends still in packets, in milliseconds
 
 #endif
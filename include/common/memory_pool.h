@@ -5,20 +5,66 @@
 #include "sys_plat.h"
 #include "locker.h"
 #include "list.h"
+#include "easy_net_config.h"
+
+/**
+ * What backs the memory of an arena. Huge pages save TLB misses on memory
+ * touched at a high rate, like the payload of packets.
+ */
+typedef enum _mem_backing_t {
+    MEM_BACKING_PAGES = 0,              // pages of the base size
+    MEM_BACKING_THP,                    // transparent huge pages, where the kernel manages to get them
+    MEM_BACKING_HUGETLB,                // huge pages reserved in the system, all mapped at init
+}mem_backing_t;
+
+#define MEM_ARENA_HUGE          (1 << 0)    // huge pages if there are any, hugetlb first, then transparent ones
+
+/**
+ * Address space reserved for memory that grows, backed by memory as it is used.
+ * Nothing is backed at first, and the backed part always starts at base, so what is
+ * allocated from an arena stays at the same place and can be indexed like an array.
+ */
+typedef struct mem_arena_t {
+    uint8_t * base;                     // 0: no arena
+    size_t size;                        // bytes reserved
+    size_t backed;                      // bytes from base backed by memory
+    size_t unit;                        // memory is backed in multiples of it
+    mem_backing_t backing;
+}mem_arena_t;
+
+net_err_t mem_arena_init(mem_arena_t * arena, size_t size, int flags);
+
+const char * mem_backing_name(mem_backing_t backing);
+
+net_err_t mem_arena_back(mem_arena_t * arena, size_t size);
+
+void mem_arena_destroy(mem_arena_t * arena);
 
 /**
  * Memory pool, all blocks are managed by a list, and each block is fixed-size.
  * The purpose is to be portable, some platforms may not support dynamic memory allocation.
+ * Blocks never used are handed out from bump, only the freed ones are in the list.
+ * A growable pool starts with the blocks in mem, and when they are all taken,
+ * adds more from its arena up to max_cnt.
  */
 typedef struct mem_t{
     void* start;
-    list_t free_list;
+    list_t free_list;                   // blocks freed
+    uint8_t * bump;                     // first of the blocks never used
+    int bump_cnt;                       // blocks never used
     locker_t locker;                    // Used to protect the list from race conditions
     sys_sem_t alloc_sem;                // Used to pause threads when all blocks are allocated
+    int blk_size;
+    int cnt;                            // blocks in the pool, in mem and in the arena
+    int max_cnt;                        // blocks the pool may grow to
+    int arena_cnt;                      // blocks taken from the arena
+    mem_arena_t arena;
 }memory_pool_t;
 
 net_err_t memory_pool_init (memory_pool_t* mem_pool, void * mem, int blk_size, int cnt, locker_type_t share_type);
 
+net_err_t memory_pool_init_grow (memory_pool_t* mem_pool, void * mem, int blk_size, int cnt, int max_cnt, locker_type_t share_type, int arena_flags);
+
 void * memory_pool_alloc(memory_pool_t * mem_pool, int ms);
 
 int memory_pool_free_cnt(memory_pool_t* list);
@@ -26,4 +72,68 @@ int memory_pool_free_cnt(memory_pool_t* list);
 void memory_pool_free(memory_pool_t * mem_pool, void * block);
 
 void memory_pool_destroy(memory_pool_t* mem_pool);
+
+struct lf_pool_t;
+typedef net_err_t (*lf_grow_t)(struct lf_pool_t * pool, int from, int cnt, void * arg);
+
+/**
+ * Lock-free variant, for pools shared by the application, worker and driver threads.
+ * The free blocks form a Treiber stack linked by block index. The head packs the index of
+ * the top block with a tag that changes on every update, so a pop working on a stale head
+ * fails its compare-and-swap instead of corrupting the stack (ABA).
+ * Allocation never takes a lock. Only a blocking caller on an empty pool sleeps on alloc_sem,
+ * and free only touches the semaphore when somebody is sleeping.
+ * Blocks never used are taken from the bump index once the stack is empty, so init touches
+ * no block and a large pool costs nothing until it is used.
+ * A growable pool has its blocks in an arena, more are added when the pool runs out,
+ * one thread at a time, after the grow hook has prepared them.
+ */
+typedef struct lf_pool_t {
+    uint8_t * start;
+    int blk_size;
+    volatile int cnt;                   // blocks in the pool
+    int max_cnt;                        // blocks the pool may grow to
+    mem_arena_t arena;                  // memory of a growable pool, start is its base
+    lf_grow_t grow;                     // prepares the blocks from .. from + cnt - 1 before they join
+    void * grow_arg;
+    volatile int growing;               // a thread is adding blocks
+    volatile uint64_t head;             // tag << 32 | (index + 1) of the top block, 0: empty
+    volatile uint64_t bump;             // index of the first block never used
+    volatile int free_cnt;              // blocks in the stack
+    volatile int waiters;               // threads sleeping in the slow path
+    int cache_cap;                      // blocks a magazine keeps at most, 0: no magazine, see lf_cache_cap
+    volatile uint64_t cache_hits;       // allocations served by the magazines of lf_cache_t, 64 bits not to wrap at packet rates
+    volatile uint64_t cache_misses;     // magazine refills
+    sys_sem_t alloc_sem;                // SYS_SEM_INVALID if the pool never blocks
+}lf_pool_t;
+
+/**
+ * Per-thread magazine in front of a lf_pool_t. Alloc and free only touch the magazine,
+ * which is refilled from and flushed to the pool half a magazine at a time. The magazine
+ * keeps at most cache_cap blocks of the pool, pools too small for one are used directly.
+ * Each thread must have its own, see SYS_THREAD_LOCAL.
+ */
+typedef struct lf_cache_t {
+    void * blocks[LF_CACHE_SIZE];
+    int cnt;
+    int hits;                           // not yet published to the pool
+}lf_cache_t;
+
+net_err_t lf_pool_init (lf_pool_t * pool, void * mem, int blk_size, int cnt, int blocking);
+
+net_err_t lf_pool_init_grow (lf_pool_t * pool, int blk_size, int cnt, int max_cnt, int blocking, int arena_flags, lf_grow_t grow, void * arg);
+
+void * lf_pool_alloc(lf_pool_t * pool, int ms);
+
+int lf_pool_free_cnt(lf_pool_t * pool);
+
+void lf_pool_free(lf_pool_t * pool, void * block);
+
+void lf_pool_destroy(lf_pool_t * pool);
+
+void * lf_cache_alloc(lf_pool_t * pool, lf_cache_t * cache);
+
+void lf_cache_free(lf_pool_t * pool, lf_cache_t * cache, void * block);
+
+void lf_cache_flush(lf_pool_t * pool, lf_cache_t * cache);
 #endif //EASY_NET_MEMORY_POOL_H
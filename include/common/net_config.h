@@ -0,0 +1,33 @@
+#ifndef EASY_NET_NET_CONFIG_H
+#define EASY_NET_NET_CONFIG_H
+
+#include "net_errors.h"
+
+#define NET_HUGE_PACKET             (1 << 0)    // pages and descriptors of packets
+#define NET_HUGE_SOCKET             (1 << 1)    // socket tables
+
+/**
+ * Sizes of the pools chosen when the stack starts, so one binary fits small and large hosts.
+ * The defaults are the sizes in easy_net_config.h, which also size the static memory of each pool.
+ * A pool configured larger than its static memory lives in an arena (see mem_arena_t)
+ * and grows on demand up to the configured size, where the platform has virtual memory.
+ */
+typedef struct _net_config_t {
+    int page_cnt;                           // small pages of packets
+    int page_mid_cnt;                       // mid pages
+    int page_big_cnt;                       // big pages
+    int packet_cnt;                         // packets
+    int msg_cnt;                            // messages queued to the handler thread, fixed at init
+    int socket_cnt;                         // sockets of the application
+    int raw_cnt;                            // raw sockets
+    int udp_cnt;                            // udp sockets
+    int tcp_cnt;                            // tcp sockets
+    int arp_cache_cnt;                      // arp cache entries
+    int huge_pages;                         // NET_HUGE_xxx, pools put in huge pages, even when they fit the static memory
+}net_config_t;
+
+void net_config_default(net_config_t * cfg);
+net_err_t net_config_set(const net_config_t * cfg);
+const net_config_t * net_config(void);
+
+#endif //EASY_NET_NET_CONFIG_H
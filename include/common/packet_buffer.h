@@ -9,19 +9,73 @@
 #define CONTINUOUS 1
 #define NON_CONTINUOUS 0
 
+#define PAGE_CLASS_CNT      3               // small, mid and big pages
+
 /**
  * Page of a packet
- * Each page has a fixed size payload buffer,
+ * Each page has a payload buffer of the size of its class,
  * the data is a continuous block of memory starting from the data pointer.
+ * An external page doesn't use its payload, data points to memory owned by the caller.
+ * A shared page is an external page whose data is in the payload of its origin page,
+ * the origin is freed when the last page sharing it is freed.
+ * An external page may have a release callback, called when the memory is no longer referenced.
+ * A driver lends its receive buffers to the stack this way, such a page is marked lent:
+ * lent memory is read only, writes go to private copies, and packets that wait or go out
+ * are detached from it first. Other external pages, like zero-copy sends, are not copied.
  */
+typedef void (*page_release_t)(void * arg);
+
 typedef struct page_t {
     list_node_t node;
     int size;                               // size of the data in this page
     uint8_t* data;                          // starting address of the data in this page
-    uint8_t payload[PACKET_PAGE_SIZE];       // data buffer
+    int ext;                                // data is outside of payload, no room to grow
+    int cls;                                // size class the page belongs to
+    int cap;                                // size of payload
+    uint8_t * payload;                      // data buffer
+    volatile int ref;                       // 1 + number of pages sharing the payload
+    struct page_t * origin;                 // the page whose payload is shared, 0: not a shared page
+    page_release_t release;                 // give the external memory back to its owner
+    int lent;                               // receive buffer lent by a driver, see packet_alloc_ext
+    void * release_arg;
 } page_t;
 
 
+/**
+ * What is known about the transport checksum of a packet.
+ * Drivers mark received packets they verified, a partial checksum on sending
+ * is completed by netif_put_out unless the driver does it.
+ */
+typedef enum _packet_csum_t {
+    PACKET_CSUM_NONE = 0,                   // rx: to be verified, tx: the checksum is complete
+    PACKET_CSUM_UNNECESSARY,                // rx: verified by the driver, or the packet never left the host
+    PACKET_CSUM_PARTIAL,                    // tx: the checksum field at csum_start + csum_offset holds the sum
+                                            // of the pseudo header, the data from csum_start is not summed yet
+    PACKET_CSUM_COMPLETE,                   // rx: csum_value is the sum of the ip payload, taken by the driver
+}packet_csum_t;
+
+/**
+ * Headers of a received packet parsed at ingress (netif_parse).
+ * The parsed headers are continuous in the first page, the network header starts at l2_len
+ * and the transport header at l2_len + l3_len in the frame as received.
+ */
+#define PACKET_HDR_L2               (1 << 0)        // l2_len and l3_proto are valid
+#define PACKET_HDR_L3               (1 << 1)        // l3_len and l4_proto are valid
+#define PACKET_HDR_L4               (1 << 2)        // l4_len and flow_hash are valid
+#define PACKET_HDR_FRAG             (1 << 3)        // an ip fragment, the transport header is parsed after reassembly
+#define PACKET_HDR_IP_OPTS          (1 << 4)        // the ip header has options
+
+/**
+ * A range of a packet read span by span, each span continuous in one page.
+ * It doesn't move the pos of the packet, so several can be used at once,
+ * the pages of the packet must not change while it is in use.
+ */
+typedef struct _packet_iter_t {
+    page_t * page;                          // page of the next span
+    int page_off;                           // where the next span starts in the page
+    int remain;                             // bytes left in the range
+}packet_iter_t;
+
 /**
  * A packet consists of a list of pages
  * The packet provides pos pointer to abstract away the details of the page list
@@ -31,10 +85,23 @@ typedef struct packet_t {
     list_t page_list;
     list_node_t node;
 
-    int ref;                                // reference counter
+    volatile int ref;                       // reference counter, updated atomically
     int pos;                                // current offset in the packet
     page_t* cur_page;                     // the page that pos pointer is currently in
     uint8_t* page_offset;                    // the offset in the current page
+
+    packet_csum_t csum;                     // checksum state
+    int csum_start;                         // partial: offset of the data to sum, moved with the headers
+    int csum_offset;                        // partial: offset of the checksum field from csum_start
+    uint16_t csum_value;                    // complete: sum given by the driver
+
+    int hdr_flags;                          // PACKET_HDR_xxx, which of the fields below are valid
+    uint16_t l2_len;                        // link header length
+    uint16_t l3_len;                        // network header length
+    uint16_t l4_len;                        // transport header length, with options
+    uint16_t l3_proto;                      // network protocol, ethernet type in host order
+    uint8_t l4_proto;                       // transport protocol of the ip header
+    uint32_t flow_hash;                     // hash of addresses and ports, same as sock_flow_hash for the receiver
 } packet_t;
 
 
@@ -43,6 +110,11 @@ static inline page_t * page_next(page_t * page) {
     return list_entry(next, page_t, node);
 }
 
+static inline page_t * page_prev(page_t * page) {
+    list_node_t * prev = list_node_pre(&page->node);
+    return list_entry(prev, page_t, node);
+}
+
 
 static inline page_t * packet_first_page(packet_t * packet) {
     list_node_t * first = list_first(&packet->page_list);
@@ -58,29 +130,62 @@ static int inline packet_total_size (packet_t * packet) {
     return packet->total_size;
 }
 
+/**
+ * memory taken by the packet, used for buffer accounting
+ */
+static inline int packet_footprint (packet_t * packet) {
+    int size = (int)sizeof(packet_t);
+    for (page_t * page = packet_first_page(packet); page; page = page_next(page)) {
+        size += (int)sizeof(page_t) + page->cap;
+    }
+    return size;
+}
+
 static inline uint8_t * packet_data (packet_t * packet) {
     page_t * first = packet_first_page(packet);
     return first ? first->data : (uint8_t *)0;
 }
 
 void packet_buffer_mem_stat(void);
+void packet_buffer_cache_flush(void);
 net_err_t packet_buffer_init(void);
 packet_t * packet_alloc(int size);
+packet_t * packet_alloc_headroom(int size, int headroom);
 void packet_free (packet_t * pkt);
 net_err_t packet_add_header(packet_t * packet, int size, int cont);
 net_err_t packet_remove_header(packet_t* packet, int size);
 net_err_t packet_resize(packet_t * packet, int to_size);
 net_err_t packet_join(packet_t* dest, packet_t* src);
 net_err_t packet_set_cont(packet_t* buf, int size);
+net_err_t packet_add_ext(packet_t * packet, const uint8_t * data, int size);
+packet_t * packet_clone(packet_t * src, int offset, int size);
+packet_t * packet_alloc_ext(const uint8_t * data, int size, page_release_t release, void * arg);
+net_err_t packet_detach(packet_t * packet);
+
+
+/**
+ * leave the checksum of the transport header at the start of the packet to the driver,
+ * the checksum field at offset has been set to the sum of the pseudo header
+ */
+static inline void packet_csum_partial(packet_t * packet, int offset) {
+    packet->csum = PACKET_CSUM_PARTIAL;
+    packet->csum_start = 0;
+    packet->csum_offset = offset;
+}
 
+net_err_t packet_csum_finish(packet_t * packet);
 
 void packet_reset_pos(packet_t * packet);
 void packet_inc_ref (packet_t * packet);
 net_err_t packet_seek(packet_t* packet, int offset);
+net_err_t packet_iter_init(packet_t * packet, packet_iter_t * iter, int offset, int size);
+int packet_iter_next(packet_iter_t * iter, uint8_t ** data);
 int packet_write(packet_t * packet, uint8_t* src, int size);
+int packet_write_csum(packet_t * packet, uint8_t* src, int size, uint32_t * sum);
 int packet_read(packet_t* packet, uint8_t* dest, int size);
 net_err_t packet_copy(packet_t * dest, packet_t* src, int size);
 net_err_t packet_fill(packet_t* packet, uint8_t val, int size);
 
 uint16_t packet_checksum16(packet_t* buf, int size, uint32_t pre_sum, int complement);
+uint16_t packet_checksum16_at(packet_t * packet, int offset, int size, uint32_t pre_sum, int complement);
 #endif //EASY_NET_PACKET_BUFFER_H
@@ -43,8 +43,33 @@ uint32_t swap_u32(uint32_t v);
 #define e_ntohl(v)        (v)
 #endif
 
+/**
+ * implementations of the checksum kernel, the best supported one is picked at run time
+ */
+typedef enum _checksum_impl_t {
+    CHECKSUM_GENERIC = 0,
+    CHECKSUM_SSE2,
+    CHECKSUM_AVX2,
+}checksum_impl_t;
+
+/**
+ * RFC 1624: the checksum after a 16-bit word covered by it changed from old_word to new_word,
+ * HC' = ~(~HC + ~m + m'). The words are taken as they are in the packet, like the checksum.
+ */
+static inline uint16_t checksum16_update(uint16_t check, uint16_t old_word, uint16_t new_word) {
+    uint32_t sum = (uint16_t)~check + (uint32_t)(uint16_t)~old_word + new_word;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
 net_err_t utils_init(void);
+net_err_t checksum_use(checksum_impl_t impl);
+checksum_impl_t checksum_impl(void);
 uint16_t checksum16(uint32_t offset, void* buf, uint16_t len, uint32_t pre_sum, int complement);
 uint16_t checksum_peso(const uint8_t* src_ip, const uint8_t* dest_ip, uint8_t protocol, packet_t* buf);
+uint16_t checksum_peso_part(const uint8_t* src_ip, const uint8_t* dest_ip, uint8_t protocol, packet_t* buf, int size, uint32_t data_sum);
+uint16_t checksum_peso_in(const uint8_t* src_ip, const uint8_t* dest_ip, uint8_t protocol, packet_t* buf);
+void checksum_peso_defer(const uint8_t* src_ip, const uint8_t* dest_ip, uint8_t protocol, packet_t* buf, uint16_t * field);
 
 #endif //EASY_NET_UTILS_H
@@ -77,6 +77,8 @@ typedef HANDLE sys_mutex_t;
 typedef HANDLE sys_thread_t;
 typedef HANDLE sys_sem_t;
 
+#define SYS_THREAD_LOCAL            __declspec(thread)
+
 #define plat_strlen         strlen
 #define plat_strcpy         strcpy
 #define plat_strncpy        strncpy
@@ -131,6 +133,8 @@ typedef struct _xsys_sem_t {
 typedef pthread_t sys_thread_t;
 typedef pthread_mutex_t * sys_mutex_t;
 
+#define SYS_THREAD_LOCAL            __thread
+
 int pcap_find_device(const char* ip, char* name_buf);
 int pcap_show_list(void);
 pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr);
@@ -150,6 +154,21 @@ void sys_mutex_lock(sys_mutex_t mutex);
 void sys_mutex_unlock(sys_mutex_t mutex);
 int sys_mutex_is_valid(sys_mutex_t mutex);
 
+// atomic operations, all with full barrier
+int sys_atomic_add(volatile int * ptr, int val);                // return the new value
+uint64_t sys_atomic_load64(volatile uint64_t * ptr);
+uint64_t sys_atomic_add64(volatile uint64_t * ptr, uint64_t val);   // return the new value
+int sys_atomic_cas64(volatile uint64_t * ptr, uint64_t expect, uint64_t desired);  // 1: swapped
+
+// virtual memory: address space is reserved up front and backed by memory piece by piece
+void * sys_mem_reserve(size_t size);                            // 0: failed
+int sys_mem_commit(void * addr, size_t size);                   // 0: ok, < 0: failed
+void sys_mem_release(void * addr, size_t size);
+size_t sys_mem_page_size(void);
+#define SYS_MEM_HUGE_PAGE_SIZE      (2 * 1024 * 1024)
+void * sys_mem_map_huge(size_t size);                           // backed by huge pages reserved at once, 0: not enough of them
+void * sys_mem_reserve_huge(size_t size);                       // like sys_mem_reserve, for transparent huge pages, 0: not supported
+
 typedef void (*sys_thread_func_t)(void * arg);
 sys_thread_t sys_thread_create(sys_thread_func_t entry, void* arg);
 void sys_thread_exit (int error);
@@ -39,6 +39,11 @@ typedef enum netif_type_t {
     NETIF_TYPE_SIZE,                    // in order to get the size of this enum conveniently
 }netif_type_t;
 
+/**
+ * what the driver does for the stack
+ */
+#define NETIF_F_TX_CSUM             (1 << 0)        // completes partial checksums of outgoing packets
+
 /**
  * network interface
  */
@@ -58,6 +63,7 @@ typedef struct _netif_t {
 
     netif_type_t type;                      // interface type
     int mtu;                                // Maximum Transfer Unit
+    int features;                           // NETIF_F_xxx
 
     const netif_ops_t* ops;                 // operations supported by network interface
     void* ops_data;                         // data for operations
@@ -86,8 +92,10 @@ typedef struct _link_layer_t {
     void(*close)(struct _netif_t* netif);
     net_err_t (*in)(struct _netif_t* netif, packet_t* buf);
     net_err_t (*out)(struct _netif_t* netif, ipaddr_t* dest, packet_t* buf);
+    net_err_t (*parse)(struct _netif_t* netif, packet_t* buf);      // fill l2_len and l3_proto of a received packet
 }link_layer_t;
 net_err_t netif_register_layer(int type, const link_layer_t* layer);
+net_err_t netif_parse(struct _netif_t* netif, packet_t* buf);
 
 
 net_err_t netif_init(void);
@@ -55,6 +55,9 @@ typedef struct _ipv4_hdr_t {
     uint8_t dest_ip[IPV4_ADDR_SIZE];
 }ipv4_hdr_t;
 
+// room kept in front of an outgoing transport packet for the ipv4 and link headers
+#define IPV4_HEADROOM           (NETIF_HEADROOM + (int)sizeof(ipv4_hdr_t))
+
 
 typedef struct _ipv4_pkt_t {
     ipv4_hdr_t hdr;
@@ -96,8 +99,11 @@ rentry_t* rt_find(ipaddr_t * ip);
 
 net_err_t ipv4_init(void);
 net_err_t ipv4_in(netif_t * netif, packet_t *buf);
+net_err_t ipv4_parse(packet_t * buf, int offset);
+void ipv4_parse_l4(packet_t * buf, int offset);
 static inline int ipv4_hdr_size(ipv4_pkt_t* pkt) {
     return pkt->hdr.shdr * 4;
 }
 net_err_t ipv4_out(uint8_t protocol, ipaddr_t* dest, ipaddr_t* src, packet_t* packet);
+net_err_t ipv4_out_rt(uint8_t protocol, ipaddr_t* dest, ipaddr_t* src, packet_t* packet, rentry_t * rt);
 #endif //EASY_NET_IPV4_H
@@ -2,8 +2,9 @@
 #define EASY_NET_STACK_H
 
 #include "net_errors.h"
+#include "net_config.h"
 
-net_err_t init_stack (void);
+net_err_t init_stack (const net_config_t * cfg);
 net_err_t start_easy_net (void);
 
 #endif
@@ -137,6 +137,18 @@ typedef struct _tcp_seg_t {
 #pragma pack()
 
 
+/**
+ * user buffer queued by a MSG_ZEROCOPY send. Each external page of an outgoing segment
+ * holds a reference on it, dropped by whichever thread frees the page. The send is completed
+ * once the buffer is acked and the socket holds the only reference left
+ */
+typedef struct _tcp_zc_t {
+    const uint8_t * data;
+    int size;
+    volatile int ref;               // 1 for the socket, 1 for each page referencing the buffer
+}tcp_zc_t;
+
+
 typedef enum _tcp_state_t {
     TCP_STATE_FREE = 0,             // not in official state list
     TCP_STATE_CLOSED,
@@ -195,7 +207,27 @@ typedef struct _tcp_t {
         int rexmit_max;     // max retransmit count
         net_timer_t timer;    // timer for retransmit
         int rto;            // Retransmission TimeOut
+        int wnd;            // window advertised by the peer
 
+        int srtt;           // smoothed round-trip time, in ms, RFC 6298
+        int rttvar;         // round-trip time variation, in ms
+        uint32_t rtt_seq;   // the segment being timed is acked when una passes this seq
+        int rtt_timing;     // a segment is being timed
+        net_time_t rtt_start; // the time the timed segment was sent
+
+        // MSG_ZEROCOPY sends, never queued together with data in buf to keep the stream in order
+        struct {
+            tcp_zc_t * tbl[TCP_ZC_MAX_NR];  // ring of user buffers, from the oldest not completed
+            int done;           // index of the oldest buffer not completed
+            int out;            // index of the oldest buffer not acked
+            int cnt;            // number of buffers not acked
+            int count;          // unacked bytes in the ring
+            int acked;          // bytes of the oldest buffer already acked
+            uint32_t next_id;   // id of the next zero-copy send
+            uint32_t done_id;   // sends before this id are completed
+            uint32_t report_id; // completions before this id have been reported
+            net_timer_t timer;  // polls acked buffers still referenced by packets
+        } zc;
     } snd;
 
 
@@ -208,6 +240,15 @@ typedef struct _tcp_t {
         sock_wait_t wait;   // rcv wait structure
     } rcv;
 
+    // statistics reported through TCP_INFO
+    struct {
+        uint64_t bytes_acked;       // bytes acked by the peer
+        uint64_t bytes_received;    // bytes accepted into the receive buffer
+        int total_retrans;          // segments retransmitted since creation, on timeouts and fast retransmits
+        int dup_acks;               // number of duplicate acks received
+        int ooo_drops;              // out-of-order segments dropped
+    } stats;
+
     tcp_state_t state;
 } tcp_t;
 
@@ -218,6 +259,14 @@ int inline tcp_rcv_window (tcp_t * tcp) {
 }
 
 
+/**
+ * bytes in the send queue, either copied into snd.buf or referenced by snd.zc
+ */
+static inline int tcp_snd_cnt (tcp_t * tcp) {
+    return tcp_buf_cnt(&tcp->snd.buf) + tcp->snd.zc.count;
+}
+
+
 #if LOG_DISP_ENABLED(LOG_TCP)
 void tcp_show_info (char * msg, tcp_t * tcp);
 void tcp_display_pkt (char * msg, tcp_hdr_t * tcp_hdr, packet_t * buf);
@@ -231,17 +280,19 @@ void tcp_show_list (void);
 
 net_err_t tcp_init(void);
 sock_t* tcp_create (int family, int protocol);
-sock_t* tcp_find(ipaddr_t * local_ip, uint16_t local_port, ipaddr_t * remote_ip, uint16_t remote_port);
+sock_t* tcp_find(packet_t * buf, ipaddr_t * local_ip, uint16_t local_port, ipaddr_t * remote_ip, uint16_t remote_port);
 void tcp_seg_init (tcp_seg_t * seg, packet_t * buf, ipaddr_t * local, ipaddr_t * remote);
 void tcp_set_hdr_size (tcp_hdr_t * hdr, int size);
 int tcp_hdr_size (tcp_hdr_t * hdr);
 
 
 net_err_t tcp_close(struct _sock_t* sock);
+net_err_t tcp_getopt(struct _sock_t* sock,  int level, int optname, char * optval, int * optlen);
 net_err_t tcp_connect(struct _sock_t* sock, const struct x_sockaddr* addr, x_socklen_t len);
 net_err_t tcp_abort (tcp_t * tcp, int err);
 net_err_t tcp_send (struct _sock_t* sock, const void* buf, size_t len, int flags, ssize_t * result_len);
 net_err_t tcp_recv (struct _sock_t* s, void* buf, size_t len, int flags, ssize_t * result_len);
+net_err_t tcp_splice (struct _sock_t * in, struct _sock_t * out, size_t len, ssize_t * result_len, struct _sock_t ** blocker);
 net_err_t tcp_listen (struct _sock_t* s, int backlog);
 net_err_t tcp_accept (struct _sock_t *s, struct x_sockaddr* addr, x_socklen_t* len, struct _sock_t ** client);
 void tcp_keepalive_start (tcp_t * tcp, int run);
@@ -251,6 +302,7 @@ void tcp_kill_all_timers (tcp_t * tcp);
 int tcp_backlog_count (tcp_t * tcp);
 tcp_t * tcp_create_child (tcp_t * parent, tcp_seg_t * seg);
 void tcp_free(tcp_t* tcp);
+int tcp_info_list (struct x_tcp_info * info, int cnt);
 #define TCP_SEQ_LE(a, b)        ((int32_t)(a) - (int32_t)(b) <= 0)
 #define TCP_SEQ_LT(a, b)        ((int32_t)(a) - (int32_t)(b) < 0)
 
@@ -15,11 +15,23 @@ typedef struct _tcp_sbuf_t {
     uint8_t * data;
 }tcp_buf_t;
 
+/**
+ * a contiguous span of the ring, the ring is described by at most two spans
+ */
+typedef struct _tcp_buf_iov_t {
+    uint8_t * data;
+    int len;
+}tcp_buf_iov_t;
+
 // initialize the buffer when connect
 void tcp_buf_init(tcp_buf_t* buf, uint8_t * data, int size);
 
+int tcp_buf_peek_free(tcp_buf_t * buf, tcp_buf_iov_t iov[2]);
+void tcp_buf_commit_write(tcp_buf_t * buf, int cnt);
+int tcp_buf_peek_data(tcp_buf_t * buf, int offset, tcp_buf_iov_t iov[2]);
+
 void tcp_buf_write_send(tcp_buf_t * dest, const uint8_t * buffer, int len);
-void tcp_buf_read_send(tcp_buf_t * src, int offset, packet_t * dest, int count);
+void tcp_buf_read_send(tcp_buf_t * src, int offset, packet_t * dest, int count, uint32_t * sum);
 int tcp_buf_write_rcv(tcp_buf_t * dest, int offset, packet_t * src, int size);
 int tcp_buf_read_rcv (tcp_buf_t * src, uint8_t * buf, int size);
 
@@ -35,5 +47,9 @@ static inline int tcp_buf_cnt (tcp_buf_t * buf) {
     return buf->count;
 }
 int tcp_buf_remove(tcp_buf_t * buf, int cnt);
+int tcp_buf_move(tcp_buf_t * dest, tcp_buf_t * src, int cnt);
+
+// consumer side of peek/commit, read data is released by removing it
+#define tcp_buf_commit_read(buf, cnt)       tcp_buf_remove(buf, cnt)
 
 #endif //EASY_NET_TCP_BUF_H
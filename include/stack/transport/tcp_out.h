@@ -13,8 +13,15 @@ net_err_t tcp_transmit(tcp_t * tcp);
 net_err_t tcp_send_syn(tcp_t* tcp);
 net_err_t tcp_send_ack(tcp_t* tcp, tcp_seg_t * seg);
 net_err_t tcp_ack_process (tcp_t * tcp, tcp_seg_t * seg);
+void tcp_rtt_sample (tcp_t * tcp, int rtt);
 net_err_t tcp_send_fin (tcp_t* tcp);
 int tcp_write_sndbuf(tcp_t * tcp, const uint8_t * buf, int len);
+int tcp_write_zc(tcp_t * tcp, const uint8_t * buf, int len);
+net_err_t tcp_zc_init(void);
+int tcp_zc_ref_data(tcp_t * tcp, packet_t * packet, int doff, int dlen);
+int tcp_zc_complete(tcp_t * tcp);
+void tcp_zc_free(tcp_t * tcp);
+int tcp_snd_remove(tcp_t * tcp, int cnt);
 net_err_t tcp_send_reset_for_tcp(tcp_t* tcp);
 void tcp_out_event (tcp_t * tcp, tcp_oevent_t event);
 net_err_t tcp_send_keepalive(tcp_t* tcp);
@@ -27,7 +27,20 @@ typedef struct _udp_pkt_t {
 typedef struct _udp_t {
     sock_t  base;                   // base class
     list_t recv_list;
+    list_t borrow_list;             // datagrams lent to the application by udp_recv_borrow
     sock_wait_t rcv_wait;
+    list_node_t hash_node;          // node in the lookup table
+    list_t * bucket;                // bucket the socket is hashed in, 0: not hashed
+    list_node_t bind_node;          // node in the bind table, connected or not
+    list_t * bind_bucket;           // bucket of the bind table, 0: no local port
+
+    int gso_size;                   // UDP_SEGMENT, 0: send one datagram per call
+    int gro;                        // UDP_GRO enabled
+    int rcv_seg_size;               // segment size of the last coalesced receive, 0: not coalesced
+
+    int rcvbuf;                     // SO_RCVBUF, limit of rcv_used
+    int rcv_used;                   // memory used by the datagrams in recv_list
+    struct x_udp_stats stats;
 }udp_t;
 
 net_err_t udp_init(void);
@@ -36,4 +49,8 @@ sock_t* udp_create(int family, int protocol);
 net_err_t udp_out(ipaddr_t* dest, uint16_t dport, ipaddr_t* src, uint16_t sport, packet_t* buf);
 net_err_t udp_sendto (struct _sock_t * sock, const void* buf, size_t len, int flags, const struct x_sockaddr* dest,
                       x_socklen_t dest_len, ssize_t * result_len);
+int udp_rcv_seg_size(sock_t * sock);
+net_err_t udp_recv_borrow(sock_t * sock, struct x_iovec * iov, int * iovcnt,
+                          struct x_sockaddr* src, ssize_t * result_len, packet_t ** handle);
+net_err_t udp_recv_release(sock_t * sock, packet_t * handle);
 #endif //EASY_NET_UDP_H
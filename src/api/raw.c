@@ -5,6 +5,7 @@
 #include "sock.h"
 #include "socket.h"
 #include "ipv4.h"
+#include "net_config.h"
 
 static raw_t raw_tbl[RAW_MAX_NR];
 static memory_pool_t raw_mblock;
@@ -14,7 +15,7 @@ static list_t raw_list;
 net_err_t raw_init(void) {
     log_info(LOG_RAW, "raw init.");
 
-    memory_pool_init(&raw_mblock, raw_tbl, sizeof(raw_t), RAW_MAX_NR, LOCKER_NONE);
+    memory_pool_init_grow(&raw_mblock, raw_tbl, sizeof(raw_t), RAW_MAX_NR, net_config()->raw_cnt, LOCKER_NONE, 0);
     init_list(&raw_list);
 
     log_info(LOG_RAW, "init done.");
@@ -33,7 +34,7 @@ static net_err_t raw_sendto (struct _sock_t * sock, const void* buf, size_t len,
         log_error(LOG_RAW, "dest is incorrect");
         return NET_ERR_WRONG_SOCKET;
     }
-    packet_t* pktbuf = packet_alloc((int)len);
+    packet_t* pktbuf = packet_alloc_headroom((int)len, IPV4_HEADROOM);
     if (!pktbuf) {
         log_error(LOG_RAW, "no buffer");
         return NET_ERR_MEM;
@@ -121,6 +122,7 @@ sock_t* raw_create(int family, int protocol) {
             .sendto = raw_sendto,
             .recvfrom = raw_recvfrom,
             .setopt = sock_setopt,
+            .getopt = sock_getopt,
             .close = raw_close,
     };
     raw_t* raw = memory_pool_alloc(&raw_mblock, -1);
@@ -149,52 +151,62 @@ create_failed:
 }
 
 /**
- * Tuple src-dst-protocol can pinpoint a raw socket.
+ * Tuple src-dst-protocol tells if a raw socket wants the packet.
  * */
-static raw_t * raw_find (ipaddr_t * src, ipaddr_t * dest, int protocol) {
-    list_node_t* node;
-    raw_t * found = (raw_t *)0;
-    list_for_each(node, &raw_list) {
-        raw_t* raw = (raw_t *)list_entry(node, sock_t, node);
-        if (raw->base.protocol && (raw->base.protocol != protocol)) {
-            continue;
-        }
-        if (!ipaddr_is_any(&raw->base.local_ip) && !ipaddr_is_equal(&raw->base.local_ip, dest)) {
-            continue;
-        }
-        if (!ipaddr_is_any(&raw->base.remote_ip) && !ipaddr_is_equal(&raw->base.remote_ip, src)) {
-            continue;
-        }
-        found = raw;
-        break;
+static int raw_match (raw_t * raw, ipaddr_t * src, ipaddr_t * dest, int protocol) {
+    if (raw->base.protocol && (raw->base.protocol != protocol)) {
+        return 0;
+    }
+    if (!ipaddr_is_any(&raw->base.local_ip) && !ipaddr_is_equal(&raw->base.local_ip, dest)) {
+        return 0;
+    }
+    if (!ipaddr_is_any(&raw->base.remote_ip) && !ipaddr_is_equal(&raw->base.remote_ip, src)) {
+        return 0;
+    }
+    return 1;
+}
+
+static void raw_deliver (raw_t * raw, packet_t * packet) {
+    if ((list_count(&raw->recv_list) < RAW_MAX_RECV) && (packet_detach(packet) == NET_OK)) {
+        list_insert_last(&raw->recv_list, &packet->node);
+        sock_wakeup((sock_t *)raw, SOCK_WAIT_READ, NET_OK);
+    } else {
+        // if the buffer queue is full, drop the packet
+        packet_free(packet);
     }
-    return found;
 }
 
 /**
  * this will be called by ipv4_in when it receives ip packets.
- * pass ip packet to raw socket. wake up previously waiting recvfrom
+ * pass ip packet to every matching raw socket. wake up previously waiting recvfrom
+ * all but the last one get a clone sharing the pages of the packet
  * */
 net_err_t raw_in(packet_t* packet) {
     ipv4_hdr_t* iphdr = (ipv4_hdr_t*)packet_data(packet);
-    net_err_t err = NET_ERR_UNREACH;
 
     ipaddr_t src, dest;
     ipaddr_from_buf(&dest, iphdr->dest_ip);
     ipaddr_from_buf(&src, iphdr->src_ip);
 
-    // to the corresponding raw socket
-    raw_t * raw = raw_find(&src, &dest, iphdr->protocol);
-    if (raw == (raw_t *)0) {
+    raw_t * found = (raw_t *)0;
+    list_node_t* node;
+    list_for_each(node, &raw_list) {
+        raw_t* raw = (raw_t *)list_entry(node, sock_t, node);
+        if (!raw_match(raw, &src, &dest, iphdr->protocol)) {
+            continue;
+        }
+        if (found) {
+            packet_t * clone = packet_clone(packet, 0, packet->total_size);
+            if (clone) {
+                raw_deliver(found, clone);
+            }
+        }
+        found = raw;
+    }
+    if (found == (raw_t *)0) {
         log_warning(LOG_RAW, "no raw for this packet");
         return NET_ERR_UNREACH;
     }
-    if (list_count(&raw->recv_list) < RAW_MAX_RECV) {
-        list_insert_last(&raw->recv_list, &packet->node);
-        sock_wakeup((sock_t *)raw, SOCK_WAIT_READ, NET_OK);
-    } else {
-        // if the buffer queue is full, drop the packet
-        packet_free(packet);
-    }
+    raw_deliver(found, packet);
     return NET_OK;
 }
@@ -8,16 +8,20 @@
 #include "utils.h"
 #include "ipv4.h"
 #include "tcp.h"
+#include "memory_pool.h"
+#include "net_config.h"
 
-#define SOCKET_MAX_NR		10
-static x_socket_t socket_tbl[SOCKET_MAX_NR];
+static x_socket_t socket_mem[SOCKET_MAX_NR];
+static x_socket_t * socket_tbl;             // socket_mem, or the arena if more sockets are configured
+static int socket_cnt;                      // sockets in the table
+static mem_arena_t socket_arena;
 
 static inline int get_index(x_socket_t* socket) {
     return (int)(socket - socket_tbl);
 }
 
 static inline x_socket_t* get_socket(int idx) {
-    if ((idx < 0) || (idx >= SOCKET_MAX_NR)) {
+    if ((idx < 0) || (idx >= socket_cnt)) {
         return (x_socket_t*)0;
     }
 
@@ -25,16 +29,34 @@ static inline x_socket_t* get_socket(int idx) {
     return s;
 }
 
+/**
+ * a table in the arena grows by the sockets fitting in the memory backed next,
+ * which is zero filled, so they are free
+ */
+static int socket_tbl_grow(void) {
+    if (!socket_arena.base) {
+        return 0;
+    }
+    int cnt = socket_cnt > MEM_POOL_GROW_MIN ? socket_cnt : MEM_POOL_GROW_MIN;
+    if (cnt > net_config()->socket_cnt - socket_cnt) {
+        cnt = net_config()->socket_cnt - socket_cnt;
+    }
+    if ((cnt <= 0) || (mem_arena_back(&socket_arena, (socket_cnt + cnt) * sizeof(x_socket_t)) < 0)) {
+        return 0;
+    }
+    socket_cnt += cnt;
+    return cnt;
+}
+
 static x_socket_t * socket_alloc (void) {
     x_socket_t * s = (x_socket_t *)0;
-    // scan from 0 to SOCKET_MAX_NR to find a free socket
+    // scan from 0 to socket_cnt to find a free socket
     // like file descriptor allocation in Linux
-    for (int i = 0; i < SOCKET_MAX_NR; i++) {
+    for (int i = 0; !s && (i < socket_cnt || socket_tbl_grow()); i++) {
         x_socket_t * curr = socket_tbl + i;
         if (curr->state == SOCKET_STATE_FREE) {
             s = curr;
             s->state = SOCKET_STATE_USED;
-            break;
         }
     }
     return s;
@@ -46,7 +68,20 @@ static void socket_free(x_socket_t* s) {
 }
 
 net_err_t socket_init(void) {
-    plat_memset(socket_tbl, 0, sizeof(socket_tbl));
+    int max_cnt = net_config()->socket_cnt;
+    mem_arena_destroy(&socket_arena);
+    socket_tbl = socket_mem;
+    socket_cnt = max_cnt < SOCKET_MAX_NR ? max_cnt : SOCKET_MAX_NR;
+    plat_memset(socket_mem, 0, sizeof(socket_mem));
+    int huge = net_config()->huge_pages & NET_HUGE_SOCKET;
+    if ((max_cnt > SOCKET_MAX_NR) || huge) {
+        if (mem_arena_init(&socket_arena, max_cnt * sizeof(x_socket_t), huge ? MEM_ARENA_HUGE : 0) == NET_OK) {
+            socket_tbl = (x_socket_t *)socket_arena.base;
+            socket_cnt = 0;
+        } else {
+            log_warning(LOG_SOCKET, "no arena for %d sockets, %d sockets only", max_cnt, socket_cnt);
+        }
+    }
     raw_init();
     return NET_OK;
 }
@@ -105,6 +140,7 @@ net_err_t sock_init(sock_t* sock, int family, int protocol, const sock_ops_t * o
     sock->err = NET_OK;
     sock->rcv_tmo = 0;
     sock->snd_tmo = 0;
+    sock->reuseport = 0;
     list_node_init(&sock->node);
     sock->conn_wait = (sock_wait_t *)0;
     sock->snd_wait = (sock_wait_t *)0;
@@ -262,6 +298,14 @@ net_err_t sock_setopt(struct _sock_t* sock,  int level, int optname, const char
                 return NET_ERR_PARAM;
             }
         }
+        case SO_REUSEPORT: {
+            if (optlen != sizeof(int)) {
+                log_error(LOG_SOCKET, "param size error");
+                return NET_ERR_PARAM;
+            }
+            sock->reuseport = *(int *)optval ? 1 : 0;
+            return NET_OK;
+        }
         default:
             break;
     }
@@ -269,6 +313,255 @@ net_err_t sock_setopt(struct _sock_t* sock,  int level, int optname, const char
 }
 
 
+net_err_t sock_getsockopt_req_in(func_msg_t * api_msg) {
+    sock_req_t * req = (sock_req_t *)api_msg->param;
+    x_socket_t* s = get_socket(req->sockfd);
+    if (!s) {
+        log_error(LOG_SOCKET, "param error: socket = %d.", s);
+        return NET_ERR_PARAM;
+    }
+    sock_t* sock = s->sock;
+    sock_getopt_t * opt = (sock_getopt_t *)&req->getopt;
+    if (!sock->ops->getopt) {
+        log_error(LOG_SOCKET, "this function is not implemented");
+        return NET_ERR_NOT_SUPPORT;
+    }
+    return sock->ops->getopt(sock, opt->level, opt->optname, opt->optval, opt->optlen);
+}
+
+
+net_err_t sock_getopt(struct _sock_t* sock,  int level, int optname, char * optval, int * optlen) {
+    if (level != SOL_SOCKET) {
+        return NET_ERR_NOT_SUPPORT;
+    }
+
+    switch (optname) {
+        case SO_RCVTIMEO:
+        case SO_SNDTIMEO: {
+            if (*optlen < (int)sizeof(struct x_timeval)) {
+                log_error(LOG_SOCKET, "time size error");
+                return NET_ERR_PARAM;
+            }
+            int time_ms = (optname == SO_RCVTIMEO) ? sock->rcv_tmo : sock->snd_tmo;
+            struct x_timeval * time = (struct x_timeval *)optval;
+            time->tv_sec = time_ms / 1000;
+            time->tv_usec = (time_ms % 1000) * 1000;
+            *optlen = sizeof(struct x_timeval);
+            return NET_OK;
+        }
+        case SO_REUSEPORT: {
+            if (*optlen < (int)sizeof(int)) {
+                log_error(LOG_SOCKET, "param size error");
+                return NET_ERR_PARAM;
+            }
+            *(int *)optval = sock->reuseport;
+            *optlen = sizeof(int);
+            return NET_OK;
+        }
+        default:
+            break;
+    }
+    return NET_ERR_NOT_SUPPORT;
+}
+
+
+/**
+ * send as many datagrams of the vector as possible in one worker-thread crossing
+ * stop at the first one that fails or has to wait, comp_cnt tells how far we got
+ */
+net_err_t sock_sendmmsg_req_in(func_msg_t * api_msg) {
+    sock_req_t * req = (sock_req_t *)api_msg->param;
+    x_socket_t* s = get_socket(req->sockfd);
+    if (!s) {
+        log_error(LOG_SOCKET, "param error: socket = %d.", s);
+        return NET_ERR_PARAM;
+    }
+    sock_t* sock = s->sock;
+    sock_mmsg_t * mmsg = &req->mmsg;
+    if (!sock->ops->sendto) {
+        log_error(LOG_SOCKET, "this function is not implemented");
+        return NET_ERR_NOT_SUPPORT;
+    }
+
+    net_err_t err = NET_OK;
+    while (mmsg->comp_cnt < mmsg->vlen) {
+        struct x_mmsghdr * msg = mmsg->vec + mmsg->comp_cnt;
+        msg->msg_len = 0;
+        if (msg->addr) {
+            err = sock->ops->sendto(sock, msg->buf, msg->len, mmsg->flags, msg->addr, msg->addr_len, &msg->msg_len);
+        } else if (sock->ops->send) {
+            err = sock->ops->send(sock, msg->buf, msg->len, mmsg->flags, &msg->msg_len);
+        } else {
+            log_error(LOG_SOCKET, "this function is not implemented");
+            err = NET_ERR_NOT_SUPPORT;
+        }
+        if (err != NET_OK) {
+            break;
+        }
+        mmsg->comp_cnt++;
+    }
+    if (err == NET_ERR_NEED_WAIT) {
+        if (sock->snd_wait) {
+            sock_wait_add(sock->snd_wait, sock->snd_tmo, req);
+        }
+    }
+    return err;
+}
+
+
+/**
+ * receive the datagrams already queued into the vector in one worker-thread crossing
+ * only wait when there is none
+ */
+net_err_t sock_recvmmsg_req_in(func_msg_t * api_msg) {
+    sock_req_t * req = (sock_req_t *)api_msg->param;
+    x_socket_t* s = get_socket(req->sockfd);
+    if (!s) {
+        log_error(LOG_SOCKET, "param error: socket = %d.", s);
+        return NET_ERR_PARAM;
+    }
+    sock_t* sock = s->sock;
+    sock_mmsg_t * mmsg = &req->mmsg;
+    if (!sock->ops->recvfrom) {
+        log_error(LOG_SOCKET, "this function is not implemented");
+        return NET_ERR_NOT_SUPPORT;
+    }
+
+    net_err_t err = NET_OK;
+    while (mmsg->comp_cnt < mmsg->vlen) {
+        struct x_mmsghdr * msg = mmsg->vec + mmsg->comp_cnt;
+        struct x_sockaddr src;
+        msg->addr_len = sizeof(struct x_sockaddr);
+        msg->msg_len = 0;
+        err = sock->ops->recvfrom(sock, msg->buf, msg->len, mmsg->flags,
+                                  msg->addr ? msg->addr : &src, &msg->addr_len, &msg->msg_len);
+        if (err != NET_OK) {
+            break;
+        }
+        msg->seg_size = (sock->protocol == IPPROTO_UDP) ? udp_rcv_seg_size(sock) : 0;
+        mmsg->comp_cnt++;
+    }
+    if (mmsg->comp_cnt) {
+        // partial completion, report what we have got
+        return NET_OK;
+    }
+    if (err == NET_ERR_NEED_WAIT) {
+        if (sock->rcv_wait) {
+            sock_wait_add(sock->rcv_wait, sock->rcv_tmo, req);
+        }
+    }
+    return err;
+}
+
+
+/**
+ * lend the next datagram to the application as a list of page pieces
+ */
+net_err_t sock_recv_borrow_req_in(func_msg_t * api_msg) {
+    sock_req_t * req = (sock_req_t *)api_msg->param;
+    x_socket_t* s = get_socket(req->sockfd);
+    if (!s) {
+        log_error(LOG_SOCKET, "param error: socket = %d.", s);
+        return NET_ERR_PARAM;
+    }
+    sock_t* sock = s->sock;
+    sock_borrow_t * borrow = &req->borrow;
+    if (sock->protocol != IPPROTO_UDP) {
+        log_error(LOG_SOCKET, "zero-copy receive is only supported by udp");
+        return NET_ERR_NOT_SUPPORT;
+    }
+
+    packet_t * pktbuf = (packet_t *)0;
+    net_err_t err = udp_recv_borrow(sock, borrow->iov, borrow->iovcnt, borrow->addr, &borrow->comp_len, &pktbuf);
+    if (err == NET_ERR_NEED_WAIT) {
+        if (sock->rcv_wait) {
+            sock_wait_add(sock->rcv_wait, sock->rcv_tmo, req);
+        }
+    }
+    borrow->handle = pktbuf;
+    if (err == NET_OK) {
+        *borrow->addr_len = sizeof(struct x_sockaddr);
+    }
+    return err;
+}
+
+
+/**
+ * give back datagrams borrowed from the socket, the handles released are cleared
+ * a handle the socket didn't lend is left as is and makes the call fail
+ */
+net_err_t sock_recv_release_req_in(func_msg_t * api_msg) {
+    sock_req_t * req = (sock_req_t *)api_msg->param;
+    x_socket_t* s = get_socket(req->sockfd);
+    if (!s) {
+        log_error(LOG_SOCKET, "param error: socket = %d.", s);
+        return NET_ERR_PARAM;
+    }
+    sock_t* sock = s->sock;
+    if (sock->protocol != IPPROTO_UDP) {
+        log_error(LOG_SOCKET, "zero-copy receive is only supported by udp");
+        return NET_ERR_NOT_SUPPORT;
+    }
+
+    net_err_t err = NET_OK;
+    sock_release_t * release = &req->release;
+    for (int i = 0; i < release->cnt; i++) {
+        if (!release->handles[i]) {
+            continue;
+        }
+        if (udp_recv_release(sock, (packet_t *)release->handles[i]) < 0) {
+            err = NET_ERR_PARAM;
+            continue;
+        }
+        release->handles[i] = (void *)0;
+    }
+    return err;
+}
+
+
+/**
+ * move received data of a tcp socket to the send queue of another one
+ */
+net_err_t sock_splice_req_in(func_msg_t * api_msg) {
+    sock_req_t * req = (sock_req_t *)api_msg->param;
+    x_socket_t * s_in = get_socket(req->sockfd);
+    x_socket_t * s_out = get_socket(req->splice.out_fd);
+    if (!s_in || !s_out || (s_in == s_out)) {
+        log_error(LOG_SOCKET, "param error: socket = %d, %d.", req->sockfd, req->splice.out_fd);
+        return NET_ERR_PARAM;
+    }
+    sock_t * in = s_in->sock;
+    sock_t * out = s_out->sock;
+    if ((in->protocol != IPPROTO_TCP) || (out->protocol != IPPROTO_TCP)) {
+        log_error(LOG_SOCKET, "splice is only supported between tcp sockets");
+        return NET_ERR_NOT_SUPPORT;
+    }
+
+    sock_t * blocker = (sock_t *)0;
+    net_err_t err = tcp_splice(in, out, req->splice.len, &req->splice.comp_len, &blocker);
+    if (err == NET_ERR_NEED_WAIT) {
+        // wait for data on the input side or for space on the output side
+        if ((blocker == in) && in->rcv_wait) {
+            sock_wait_add(in->rcv_wait, in->rcv_tmo, req);
+        } else if ((blocker == out) && out->snd_wait) {
+            sock_wait_add(out->snd_wait, out->snd_tmo, req);
+        }
+    }
+    return err;
+}
+
+
+/**
+ * collect statistics of all tcp connections, like ss -ti
+ */
+net_err_t sock_tcp_info_req_in(func_msg_t * api_msg) {
+    sock_req_t * req = (sock_req_t *)api_msg->param;
+    sock_info_t * info = (sock_info_t *)&req->info;
+    info->cnt = tcp_info_list(info->info, info->cnt);
+    return NET_OK;
+}
+
+
 void sock_wakeup (sock_t * sock, int type, int err) {
     if (type & SOCK_WAIT_CONN) {
         sock_wait_leave(sock->conn_wait, err);
@@ -285,6 +578,23 @@ void sock_wakeup (sock_t * sock, int type, int err) {
 }
 
 
+/**
+ * hash of a four-tuple, used to spread flows over SO_REUSEPORT sockets
+ * the same flow always gets the same value, so it stays on the same socket
+ */
+uint32_t sock_flow_hash (const ipaddr_t * local_ip, uint16_t local_port, const ipaddr_t * remote_ip, uint16_t remote_port) {
+    uint32_t h = local_ip->q_addr ^ (remote_ip->q_addr * 0x9e3779b1u);
+    h ^= ((uint32_t)local_port << 16) | remote_port;
+    // final mix, so that close addresses and ports land far apart
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+
 net_err_t sock_close_req_in (func_msg_t* api_msg) {
     sock_req_t * req = (sock_req_t *)api_msg->param;
     x_socket_t* s = get_socket(req->sockfd);
@@ -2,6 +2,9 @@
 #include "easy_net_config.h"
 #include "sock.h"
 #include "socket.h"
+#include "tcp_state.h"
+#include "net_config.h"
+#include "sys_plat.h"
 
 int x_socket(int family, int type, int protocol) {
     sock_req_t req;
@@ -45,8 +48,9 @@ ssize_t x_sendto(int sockfd, const void* buf, size_t size, int flags, const stru
         req.data.comp_len = 0;
         net_err_t err = exmsg_func_exec(sock_sendto_req_in, &req);
         if (err < 0) {
+            // what was sent before stays sent, the caller sees a short write
             log_error(LOG_SOCKET, "write failed.");
-            return -1;
+            return send_size ? send_size : -1;
         }
         // if the handler tells us to wait for some time, we should wait for it
         if (req.wait && ((err = sock_wait_enter(req.wait, req.wait_tmo)) < NET_OK)) {
@@ -122,6 +126,100 @@ int x_setsockopt(int sockfd, int level, int optname, const char * optval, int op
 }
 
 
+int x_getsockopt(int sockfd, int level, int optname, char * optval, int * optlen) {
+    if (!optval || !optlen || (*optlen <= 0)) {
+        log_error(LOG_SOCKET, "param error", NET_ERR_PARAM);
+        return -1;
+    }
+
+    sock_req_t req;
+    req.wait = 0;
+    req.sockfd = sockfd;
+    req.getopt.level = level;
+    req.getopt.optname = optname;
+    req.getopt.optval = optval;
+    req.getopt.optlen = optlen;
+    net_err_t err = exmsg_func_exec(sock_getsockopt_req_in, &req);
+    if (err < 0) {
+        log_error(LOG_SOCKET, "getopt: %d", err);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * get statistics of at most cnt tcp connections, return the number of entries filled
+ */
+int x_tcp_info_list(struct x_tcp_info * info, int cnt) {
+    if (!info || (cnt <= 0)) {
+        log_error(LOG_SOCKET, "param error", NET_ERR_PARAM);
+        return -1;
+    }
+
+    sock_req_t req;
+    req.wait = 0;
+    req.sockfd = -1;
+    req.info.info = info;
+    req.info.cnt = cnt;
+    net_err_t err = exmsg_func_exec(sock_tcp_info_req_in, &req);
+    if (err < 0) {
+        log_error(LOG_SOCKET, "tcp info: %d", err);
+        return -1;
+    }
+    return req.info.cnt;
+}
+
+
+/**
+ * print all tcp connections, like ss -ti
+ */
+void x_tcp_dump(void) {
+    static struct x_tcp_info tcp_info_tbl[TCP_MAX_NR];
+
+    // net_config_set may have sized the tcp pool above the static table
+    int max_cnt = net_config()->tcp_cnt;
+    size_t size = max_cnt * sizeof(struct x_tcp_info);
+    struct x_tcp_info * info_tbl = tcp_info_tbl;
+    if (max_cnt > TCP_MAX_NR) {
+        info_tbl = (struct x_tcp_info *)sys_mem_reserve(size);
+        if (!info_tbl || (sys_mem_commit(info_tbl, size) < 0)) {
+            log_error(LOG_SOCKET, "no memory for %d tcp info", max_cnt);
+            if (info_tbl) {
+                sys_mem_release(info_tbl, size);
+            }
+            return;
+        }
+    }
+
+    int cnt = x_tcp_info_list(info_tbl, max_cnt);
+    if (cnt >= 0) {
+        plat_printf("-------- tcp connections: %d -----\n", cnt);
+    }
+    for (int i = 0; i < cnt; i++) {
+        struct x_tcp_info * info = info_tbl + i;
+        plat_printf("%-12s %d.%d.%d.%d:%u -> %d.%d.%d.%d:%u\n", tcp_state_name(info->state),
+                    info->local_addr.addr0, info->local_addr.addr1, info->local_addr.addr2,
+                    info->local_addr.addr3, info->local_port,
+                    info->remote_addr.addr0, info->remote_addr.addr1, info->remote_addr.addr2,
+                    info->remote_addr.addr3, info->remote_port);
+        plat_printf("    rto:%d rtt:%d/%d mss:%d cwnd:%d ssthresh:%d snd_wnd:%d rcv_wnd:%d\n",
+                    info->rto, info->srtt, info->rttvar, info->mss,
+                    info->snd_cwnd, info->snd_ssthresh, info->snd_wnd, info->rcv_wnd);
+        plat_printf("    bytes_acked:%llu bytes_received:%llu unacked:%d\n",
+                    (unsigned long long)info->bytes_acked, (unsigned long long)info->bytes_received, info->unacked);
+        plat_printf("    retrans:%d/%d dup_acks:%d ooo_drops:%d sndbuf:%d/%d rcvbuf:%d/%d\n",
+                    info->retransmits, info->total_retrans, info->dup_acks, info->ooo_drops,
+                    info->snd_buf_used, info->snd_buf_size, info->rcv_buf_used, info->rcv_buf_size);
+    }
+
+    if (info_tbl != tcp_info_tbl) {
+        sys_mem_release(info_tbl, size);
+    }
+}
+
+
 int x_close(int sockfd) {
     sock_req_t req;
     req.wait = 0;
@@ -236,6 +334,185 @@ ssize_t x_recv(int sockfd, void* buf, size_t len, int flags) {
 }
 
 
+/**
+ * send a vector of datagrams, return the number of datagrams sent
+ * if some datagrams have been sent before an error, the count is returned and the error is dropped
+ */
+int x_sendmmsg(int sockfd, struct x_mmsghdr * msgvec, int vlen, int flags) {
+    if (!msgvec || (vlen <= 0)) {
+        log_error(LOG_SOCKET, "param error", NET_ERR_PARAM);
+        return -1;
+    }
+
+    sock_req_t req;
+    req.sockfd = sockfd;
+    req.mmsg.vec = msgvec;
+    req.mmsg.vlen = vlen;
+    req.mmsg.flags = flags;
+    req.mmsg.comp_cnt = 0;
+    while (1) {
+        req.wait = 0;
+        net_err_t err = exmsg_func_exec(sock_sendmmsg_req_in, &req);
+        if (err < 0) {
+            log_error(LOG_SOCKET, "sendmmsg failed: %d", err);
+            return req.mmsg.comp_cnt ? req.mmsg.comp_cnt : -1;
+        }
+        if (!req.wait || (req.mmsg.comp_cnt >= vlen)) {
+            return req.mmsg.comp_cnt;
+        }
+        if ((err = sock_wait_enter(req.wait, req.wait_tmo)) < NET_OK) {
+            log_error(LOG_SOCKET, "sendmmsg failed %d.", err);
+            return req.mmsg.comp_cnt ? req.mmsg.comp_cnt : -1;
+        }
+    }
+}
+
+
+/**
+ * receive at most vlen datagrams, block until there is at least one
+ * return the number of datagrams received
+ */
+int x_recvmmsg(int sockfd, struct x_mmsghdr * msgvec, int vlen, int flags) {
+    if (!msgvec || (vlen <= 0)) {
+        log_error(LOG_SOCKET, "param error", NET_ERR_PARAM);
+        return -1;
+    }
+
+    sock_req_t req;
+    req.sockfd = sockfd;
+    req.mmsg.vec = msgvec;
+    req.mmsg.vlen = vlen;
+    req.mmsg.flags = flags;
+    req.mmsg.comp_cnt = 0;
+    while (1) {
+        req.wait = 0;
+        net_err_t err = exmsg_func_exec(sock_recvmmsg_req_in, &req);
+        if (err < 0) {
+            log_error(LOG_SOCKET, "recvmmsg failed: %d", err);
+            return -1;
+        }
+        if (req.mmsg.comp_cnt) {
+            return req.mmsg.comp_cnt;
+        }
+        err = sock_wait_enter(req.wait, req.wait_tmo);
+        if (err == NET_ERR_CLOSED) {
+            log_warning(LOG_SOCKET, "connection closed by remote");
+            return 0;
+        }
+        if (err < 0) {
+            log_error(LOG_SOCKET, "recvmmsg failed %d.", err);
+            return -1;
+        }
+    }
+}
+
+
+/**
+ * receive a datagram without copying it: iov is filled with read-only pieces of the datagram,
+ * which stay valid until handle is given back with x_recv_release()
+ * iovcnt is the capacity of iov, and is set to the pieces filled
+ * if the capacity is too small, -1 is returned and iovcnt is set to the count needed
+ * return the size of the datagram
+ */
+ssize_t x_recvfrom_zc(int sockfd, struct x_iovec * iov, int * iovcnt,
+                      struct x_sockaddr* src, x_socklen_t* src_len, void ** handle) {
+    if (!iov || !iovcnt || (*iovcnt <= 0) || !src || !src_len || !handle) {
+        log_error(LOG_SOCKET, "param error", NET_ERR_PARAM);
+        return -1;
+    }
+    while (1) {
+        sock_req_t req;
+        req.sockfd = sockfd;
+        req.wait = 0;
+        req.borrow.iov = iov;
+        req.borrow.iovcnt = iovcnt;
+        req.borrow.addr = src;
+        req.borrow.addr_len = src_len;
+        req.borrow.comp_len = 0;
+        req.borrow.handle = (void *)0;
+        net_err_t err = exmsg_func_exec(sock_recv_borrow_req_in, &req);
+        if (err < 0) {
+            log_error(LOG_SOCKET, "recv zc failed: %d", err);
+            return -1;
+        }
+        if (req.borrow.handle) {
+            *handle = req.borrow.handle;
+            return req.borrow.comp_len;
+        }
+        err = sock_wait_enter(req.wait, req.wait_tmo);
+        if (err < 0) {
+            log_error(LOG_SOCKET, "recv zc failed %d.", err);
+            return -1;
+        }
+    }
+}
+
+
+/**
+ * give back datagrams borrowed from sockfd by x_recvfrom_zc() in one go
+ * the handles given back are cleared, -1 if any of them was not lent by sockfd
+ */
+int x_recv_release(int sockfd, void ** handles, int cnt) {
+    if (!handles || (cnt <= 0)) {
+        log_error(LOG_SOCKET, "param error", NET_ERR_PARAM);
+        return -1;
+    }
+
+    sock_req_t req;
+    req.sockfd = sockfd;
+    req.wait = 0;
+    req.release.handles = handles;
+    req.release.cnt = cnt;
+    net_err_t err = exmsg_func_exec(sock_recv_release_req_in, &req);
+    if (err < 0) {
+        log_error(LOG_SOCKET, "release failed: %d", err);
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * move at most len bytes received on in_fd to the send queue of out_fd inside the stack
+ * no user buffer is involved, return the bytes moved, 0 if in_fd is closed by remote
+ */
+ssize_t x_splice(int in_fd, int out_fd, size_t len) {
+    if (!len) {
+        log_error(LOG_SOCKET, "param error", NET_ERR_PARAM);
+        return -1;
+    }
+    while (1) {
+        sock_req_t req;
+        req.wait = 0;
+        req.sockfd = in_fd;
+        req.splice.out_fd = out_fd;
+        req.splice.len = len;
+        req.splice.comp_len = 0;
+        net_err_t err = exmsg_func_exec(sock_splice_req_in, &req);
+        if (err < 0) {
+            log_error(LOG_SOCKET, "splice failed: %d", err);
+            return -1;
+        }
+        if (req.splice.comp_len) {
+            return req.splice.comp_len;
+        }
+        if (!req.wait) {
+            // remote closed and all data has been moved
+            return 0;
+        }
+        err = sock_wait_enter(req.wait, req.wait_tmo);
+        if (err == NET_ERR_CLOSED) {
+            log_warning(LOG_SOCKET, "connection closed by remote");
+            return 0;
+        }
+        if (err < 0) {
+            log_error(LOG_SOCKET, "splice failed %d.", err);
+            return -1;
+        }
+    }
+}
+
+
 /**
  * bind is to set local address and local port
  * to limit the scope of the socket
@@ -5,18 +5,149 @@
 #include "easy_net_config.h"
 
 
+/**
+ * reserve size bytes of address space, none of it is backed yet.
+ * With MEM_ARENA_HUGE, huge pages reserved in the system are taken if there are enough of them
+ * for the whole arena, they are mapped at once. Otherwise transparent huge pages are asked for,
+ * and at last the arena has pages of the base size like without the flag
+ * */
+net_err_t mem_arena_init(mem_arena_t * arena, size_t size, int flags) {
+    arena->backed = 0;
+    arena->unit = sys_mem_page_size();
+    arena->backing = MEM_BACKING_PAGES;
+    arena->base = (uint8_t *)0;
+
+    if (flags & MEM_ARENA_HUGE) {
+        size_t huge_size = (size + SYS_MEM_HUGE_PAGE_SIZE - 1) & ~((size_t)SYS_MEM_HUGE_PAGE_SIZE - 1);
+        if ((arena->base = (uint8_t *)sys_mem_map_huge(huge_size))) {
+            arena->backing = MEM_BACKING_HUGETLB;
+            arena->backed = huge_size;
+        } else if ((arena->base = (uint8_t *)sys_mem_reserve_huge(huge_size))) {
+            arena->backing = MEM_BACKING_THP;
+        }
+        if (arena->base) {
+            arena->unit = SYS_MEM_HUGE_PAGE_SIZE;
+            arena->size = huge_size;
+            return NET_OK;
+        }
+        log_warning(LOG_MEMORY_POOL, "no huge pages for %d bytes.", (int)size);
+    }
+
+    size = (size + arena->unit - 1) & ~(arena->unit - 1);
+    arena->base = (uint8_t *)sys_mem_reserve(size);
+    arena->size = arena->base ? size : 0;
+    if (!arena->base) {
+        log_warning(LOG_MEMORY_POOL, "reserve %d bytes failed.", (int)size);
+        return NET_ERR_MEM;
+    }
+    return NET_OK;
+}
+
+const char * mem_backing_name(mem_backing_t backing) {
+    switch (backing) {
+        case MEM_BACKING_THP:
+            return "thp";
+        case MEM_BACKING_HUGETLB:
+            return "hugetlb";
+        default:
+            return "pages";
+    }
+}
+
+/**
+ * make sure the first size bytes of the arena are backed by memory
+ * */
+net_err_t mem_arena_back(mem_arena_t * arena, size_t size) {
+    if (size <= arena->backed) {
+        return NET_OK;
+    }
+    if (size > arena->size) {
+        return NET_ERR_MEM;
+    }
+
+    size = (size + arena->unit - 1) & ~(arena->unit - 1);
+    size = size > arena->size ? arena->size : size;
+    if (sys_mem_commit(arena->base + arena->backed, size - arena->backed) < 0) {
+        log_warning(LOG_MEMORY_POOL, "commit %d bytes failed.", (int)(size - arena->backed));
+        return NET_ERR_MEM;
+    }
+    arena->backed = size;
+    return NET_OK;
+}
+
+void mem_arena_destroy(mem_arena_t * arena) {
+    if (arena->base) {
+        sys_mem_release(arena->base, arena->size);
+        arena->base = (uint8_t *)0;
+        arena->size = arena->backed = 0;
+    }
+}
+
+/**
+ * blocks ready to be allocated, the freed ones and the ones never used
+ * */
+static inline int memory_pool_avail(memory_pool_t * mem_pool) {
+    return list_count(&mem_pool->free_list) + mem_pool->bump_cnt;
+}
+
+/**
+ * a freed block if any, they are warm in the cache, otherwise the next block never used
+ * */
+static void * memory_pool_take(memory_pool_t * mem_pool) {
+    list_node_t * block = list_remove_first(&mem_pool->free_list);
+    if (!block && mem_pool->bump_cnt) {
+        block = (list_node_t *)mem_pool->bump;
+        mem_pool->bump += mem_pool->blk_size;
+        mem_pool->bump_cnt--;
+    }
+    return block;
+}
+
+/**
+ * add blocks from the arena, as many as the pool has, at least MEM_POOL_GROW_MIN
+ * called with the pool locked, when all blocks are taken
+ * */
+static int memory_pool_grow(memory_pool_t * mem_pool) {
+    int cnt = mem_pool->cnt > MEM_POOL_GROW_MIN ? mem_pool->cnt : MEM_POOL_GROW_MIN;
+    if (cnt > mem_pool->max_cnt - mem_pool->cnt) {
+        cnt = mem_pool->max_cnt - mem_pool->cnt;
+    }
+    if (cnt <= 0) {
+        return 0;
+    }
+
+    size_t offset = (size_t)mem_pool->arena_cnt * mem_pool->blk_size;
+    if (mem_arena_back(&mem_pool->arena, offset + (size_t)cnt * mem_pool->blk_size) < 0) {
+        return 0;
+    }
+    mem_pool->bump = mem_pool->arena.base + offset;
+    mem_pool->bump_cnt = cnt;
+    mem_pool->arena_cnt += cnt;
+    mem_pool->cnt += cnt;
+    log_info(LOG_MEMORY_POOL, "pool grows to %d blocks.", mem_pool->cnt);
+
+    if (mem_pool->locker.type != LOCKER_NONE) {
+        for (int i = 0; i < cnt; i++) {
+            sys_sem_notify(mem_pool->alloc_sem);
+        }
+    }
+    return cnt;
+}
+
 net_err_t memory_pool_init (memory_pool_t* mem_pool, void * mem, int blk_size, int cnt, locker_type_t share_type) {
     // The size of each block must be greater than or equal to the size of list_node_t
     assert_halt(blk_size >= sizeof(list_node_t), "size error");
 
-    // Add all the blocks to the free list
-    uint8_t* buf = (uint8_t*)mem;
+    // No block is touched here, they are handed out in address order as they are first needed,
+    // and only go to the free list once freed, so a large pool costs nothing until it is used
+    mem_pool->start = mem;
+    mem_pool->blk_size = blk_size;
+    mem_pool->cnt = mem_pool->max_cnt = cnt;
+    mem_pool->bump = (uint8_t *)mem;
+    mem_pool->bump_cnt = cnt;
+    mem_pool->arena_cnt = 0;
+    mem_pool->arena.base = (uint8_t *)0;
     init_list(&mem_pool->free_list);
-    for (int i = 0; i < cnt; i++, buf += blk_size) {
-        list_node_t* block = (list_node_t*)buf;
-        list_node_init(block);
-        list_insert_last(&mem_pool->free_list, block);
-    }
     locker_init(&mem_pool->locker, share_type);
     if (share_type != LOCKER_NONE) {
         mem_pool->alloc_sem = sys_sem_create(cnt);
@@ -29,12 +160,40 @@ net_err_t memory_pool_init (memory_pool_t* mem_pool, void * mem, int blk_size, i
     return NET_OK;
 }
 
+/**
+ * A pool of the cnt blocks in mem that grows up to max_cnt blocks, if the platform can reserve an arena for them.
+ * With MEM_ARENA_HUGE all blocks are in the arena and mem is only used when there is no arena.
+ * */
+net_err_t memory_pool_init_grow (memory_pool_t* mem_pool, void * mem, int blk_size, int cnt, int max_cnt, locker_type_t share_type, int arena_flags) {
+    cnt = cnt > max_cnt ? max_cnt : cnt;
+    mem_arena_t arena = {.base = (uint8_t *)0};
+    if ((arena_flags & MEM_ARENA_HUGE) && (mem_arena_init(&arena, (size_t)max_cnt * blk_size, arena_flags) == NET_OK)) {
+        cnt = 0;
+    } else if ((max_cnt > cnt) && (mem_arena_init(&arena, (size_t)(max_cnt - cnt) * blk_size, arena_flags) < 0)) {
+        log_warning(LOG_MEMORY_POOL, "no arena, the pool stays at %d blocks.", cnt);
+    }
+
+    net_err_t err = memory_pool_init(mem_pool, mem, blk_size, cnt, share_type);
+    if (err < 0) {
+        mem_arena_destroy(&arena);
+        return err;
+    }
+    if (arena.base) {
+        mem_pool->arena = arena;
+        mem_pool->max_cnt = max_cnt;
+    }
+    return NET_OK;
+}
+
 void * memory_pool_alloc(memory_pool_t* mem_pool, int ms) {
-    if ((ms < 0) || (mem_pool->locker.type == LOCKER_NONE)) {
+    if ((ms < 0) || (mem_pool->locker.type == LOCKER_NONE) || (mem_pool->cnt < mem_pool->max_cnt)) {
         locker_lock(&mem_pool->locker);
-        int count = list_count(&mem_pool->free_list);
-        locker_unlock(&mem_pool->locker);
+        int count = memory_pool_avail(mem_pool);
         if (count == 0) {
+            count = memory_pool_grow(mem_pool);
+        }
+        locker_unlock(&mem_pool->locker);
+        if ((count == 0) && ((ms < 0) || (mem_pool->locker.type == LOCKER_NONE))) {
             return (void*)0;
         }
     }
@@ -42,14 +201,14 @@ void * memory_pool_alloc(memory_pool_t* mem_pool, int ms) {
         sys_sem_wait(mem_pool->alloc_sem, ms);
     }
     locker_lock(&mem_pool->locker);
-    list_node_t* block = list_remove_first(&mem_pool->free_list);
+    void * block = memory_pool_take(mem_pool);
     locker_unlock(&mem_pool->locker);
     return block;
 }
 
 int memory_pool_free_cnt(memory_pool_t* list) {
     locker_lock(&list->locker);
-    int count = list_count(&list->free_list);
+    int count = memory_pool_avail(list);
     locker_unlock(&list->locker);
     return count;
 }
@@ -70,4 +229,320 @@ void memory_pool_destroy(memory_pool_t*  mem_pool) {
         sys_sem_free(mem_pool->alloc_sem);
         locker_destroy(&mem_pool->locker);
     }
+    mem_arena_destroy(&mem_pool->arena);
+}
+
+
+#define LF_HEAD(tag, idx)           (((uint64_t)(tag) << 32) | (uint32_t)(idx))
+#define LF_HEAD_IDX(head)           ((uint32_t)(head))
+#define LF_HEAD_TAG(head)           ((uint32_t)((head) >> 32))
+
+// a free block keeps the index + 1 of the next free block in its first bytes
+static inline volatile uint32_t * lf_next(lf_pool_t * pool, uint32_t idx) {
+    return (volatile uint32_t *)(pool->start + (size_t)(idx - 1) * pool->blk_size);
+}
+
+static inline uint32_t lf_index(lf_pool_t * pool, void * block) {
+    return (uint32_t)(((uint8_t *)block - pool->start) / pool->blk_size) + 1;
+}
+
+/**
+ * pop up to n blocks with one compare-and-swap
+ * the chain is read before the swap, if any other thread touched the stack meanwhile,
+ * the tag has changed and the swap fails. A block taken by another thread may already hold
+ * user data instead of a link, so the links are range checked before being followed
+ */
+static int lf_pop_batch(lf_pool_t * pool, void ** blocks, int n) {
+    uint64_t head = sys_atomic_load64(&pool->head);
+    while (LF_HEAD_IDX(head)) {
+        int cnt = 0;
+        uint32_t idx = LF_HEAD_IDX(head);
+        while (idx && (cnt < n)) {
+            if (idx > (uint32_t)pool->cnt) {
+                break;
+            }
+            blocks[cnt++] = (void *)lf_next(pool, idx);
+            idx = *lf_next(pool, idx);
+        }
+
+        if ((idx <= (uint32_t)pool->cnt) && sys_atomic_cas64(&pool->head, head, LF_HEAD(LF_HEAD_TAG(head) + 1, idx))) {
+            sys_atomic_add(&pool->free_cnt, -cnt);
+            return cnt;
+        }
+        head = sys_atomic_load64(&pool->head);
+    }
+    return 0;
+}
+
+/**
+ * link the blocks privately, then push the whole chain with one compare-and-swap
+ */
+static void lf_push_batch(lf_pool_t * pool, void ** blocks, int n) {
+    for (int i = 0; i < n - 1; i++) {
+        *lf_next(pool, lf_index(pool, blocks[i])) = lf_index(pool, blocks[i + 1]);
+    }
+    uint32_t first = lf_index(pool, blocks[0]);
+    volatile uint32_t * last_next = lf_next(pool, lf_index(pool, blocks[n - 1]));
+
+    uint64_t head = sys_atomic_load64(&pool->head);
+    for (;;) {
+        *last_next = LF_HEAD_IDX(head);
+        if (sys_atomic_cas64(&pool->head, head, LF_HEAD(LF_HEAD_TAG(head) + 1, first))) {
+            break;
+        }
+        head = sys_atomic_load64(&pool->head);
+    }
+    sys_atomic_add(&pool->free_cnt, n);
+}
+
+/**
+ * take up to n blocks never used before, the ones from the bump index on
+ */
+static int lf_bump(lf_pool_t * pool, void ** blocks, int n) {
+    uint64_t used = sys_atomic_load64(&pool->bump);
+    for (;;) {
+        int cnt = pool->cnt - (int)used;
+        if (cnt <= 0) {
+            return 0;
+        }
+        cnt = cnt > n ? n : cnt;
+        if (sys_atomic_cas64(&pool->bump, used, used + cnt)) {
+            for (int i = 0; i < cnt; i++) {
+                blocks[i] = pool->start + (size_t)(used + i) * pool->blk_size;
+            }
+            return cnt;
+        }
+        used = sys_atomic_load64(&pool->bump);
+    }
+}
+
+/**
+ * freed blocks first, they are warm in the cache
+ */
+static int lf_take(lf_pool_t * pool, void ** blocks, int n) {
+    int cnt = lf_pop_batch(pool, blocks, n);
+    return cnt ? cnt : lf_bump(pool, blocks, n);
+}
+
+static void * lf_pop(lf_pool_t * pool) {
+    void * block;
+    return lf_take(pool, &block, 1) ? block : (void *)0;
+}
+
+static void lf_push(lf_pool_t * pool, void * block) {
+    lf_push_batch(pool, &block, 1);
+}
+
+// wake up a thread sleeping in the slow path of lf_pool_alloc
+static void lf_notify(lf_pool_t * pool) {
+    if ((pool->alloc_sem != SYS_SEM_INVALID) && (sys_atomic_add(&pool->waiters, 0) > 0)) {
+        sys_sem_notify(pool->alloc_sem);
+    }
+}
+
+
+/**
+ * add blocks from the arena, as many as the pool has, at least MEM_POOL_GROW_MIN
+ * if another thread is at it, return 0 rather than wait, its blocks are there soon
+ */
+static int lf_pool_extend(lf_pool_t * pool, int cnt) {
+    if (pool->cnt >= pool->max_cnt) {
+        return 0;
+    }
+    if (sys_atomic_add(&pool->growing, 1) != 1) {
+        sys_atomic_add(&pool->growing, -1);
+        return 0;
+    }
+
+    cnt = cnt > pool->max_cnt - pool->cnt ? pool->max_cnt - pool->cnt : cnt;
+    if ((mem_arena_back(&pool->arena, (size_t)(pool->cnt + cnt) * pool->blk_size) < 0)
+            || (pool->grow && (pool->grow(pool, pool->cnt, cnt, pool->grow_arg) < 0))) {
+        cnt = 0;
+    } else {
+        // the new blocks are past the bump index, nothing to link
+        sys_atomic_add(&pool->cnt, cnt);
+        lf_notify(pool);
+        log_info(LOG_MEMORY_POOL, "pool grows to %d blocks.", pool->cnt);
+    }
+    sys_atomic_add(&pool->growing, -1);
+    return cnt;
+}
+
+static inline int lf_grow_cnt(lf_pool_t * pool) {
+    return pool->cnt > MEM_POOL_GROW_MIN ? pool->cnt : MEM_POOL_GROW_MIN;
+}
+
+/**
+ * a magazine strands its blocks in one thread, a small pool gets small magazines, so that
+ * the other threads still find blocks, and none if even two blocks are too many
+ */
+static int lf_cache_cap(int max_cnt) {
+    int cap = (max_cnt / LF_CACHE_SHARE) & ~1;
+    cap = cap > LF_CACHE_SIZE ? LF_CACHE_SIZE : cap;
+    return cap < 2 ? 0 : cap;
+}
+
+net_err_t lf_pool_init (lf_pool_t * pool, void * mem, int blk_size, int cnt, int blocking) {
+    assert_halt(blk_size >= (int)sizeof(uint32_t), "size error");
+
+    pool->start = (uint8_t *)mem;
+    pool->blk_size = blk_size;
+    pool->cnt = pool->max_cnt = cnt;
+    pool->arena.base = (uint8_t *)0;
+    pool->grow = (lf_grow_t)0;
+    pool->growing = 0;
+    pool->waiters = 0;
+    pool->cache_cap = lf_cache_cap(cnt);
+    pool->cache_hits = 0;
+    pool->cache_misses = 0;
+    pool->alloc_sem = SYS_SEM_INVALID;
+
+    // the blocks are handed out from the bump index in address order, none is touched here
+    pool->head = LF_HEAD(0, 0);
+    pool->bump = 0;
+    pool->free_cnt = 0;
+
+    if (blocking) {
+        pool->alloc_sem = sys_sem_create(0);
+        if (pool->alloc_sem == SYS_SEM_INVALID) {
+            log_error(LOG_MEMORY_POOL, "create sem failed.");
+            return NET_ERR_SYS;
+        }
+    }
+    return NET_OK;
+}
+
+/**
+ * A pool in an arena reserved for max_cnt blocks, starting with cnt of them.
+ * grow, if any, prepares the blocks before they are handed out, and may refuse them.
+ */
+net_err_t lf_pool_init_grow (lf_pool_t * pool, int blk_size, int cnt, int max_cnt, int blocking, int arena_flags, lf_grow_t grow, void * arg) {
+    net_err_t err = lf_pool_init(pool, (void *)0, blk_size, 0, blocking);
+    if (err < 0) {
+        return err;
+    }
+    if ((err = mem_arena_init(&pool->arena, (size_t)max_cnt * blk_size, arena_flags)) < 0) {
+        lf_pool_destroy(pool);
+        return err;
+    }
+    pool->start = pool->arena.base;
+    pool->max_cnt = max_cnt;
+    pool->cache_cap = lf_cache_cap(max_cnt);
+    pool->grow = grow;
+    pool->grow_arg = arg;
+    if (cnt && !lf_pool_extend(pool, cnt)) {
+        log_error(LOG_MEMORY_POOL, "no memory for %d blocks.", cnt);
+        lf_pool_destroy(pool);
+        return NET_ERR_MEM;
+    }
+    return NET_OK;
+}
+
+/**
+ * ms < 0: never block, return null when the pool is empty
+ * ms = 0: wait until a block is freed, ms > 0: wait at most ms
+ */
+void * lf_pool_alloc(lf_pool_t * pool, int ms) {
+    // fast path
+    void * block = lf_pop(pool);
+    if (!block && lf_pool_extend(pool, lf_grow_cnt(pool))) {
+        block = lf_pop(pool);
+    }
+    if (block || (ms < 0) || (pool->alloc_sem == SYS_SEM_INVALID)) {
+        return block;
+    }
+
+    // slow path, announce ourselves before the retry, so that a free in between always notifies
+    // a wakeup lost to another thread waits again for what is left of ms only
+    net_time_t time;
+    sys_time_curr(&time);
+    sys_atomic_add(&pool->waiters, 1);
+    while ((block = lf_pop(pool)) == (void *)0) {
+        if (sys_sem_wait(pool->alloc_sem, ms) < 0) {
+            break;
+        }
+        if (ms > 0) {
+            ms -= sys_time_goes(&time);
+            if (ms <= 0) {
+                block = lf_pop(pool);
+                break;
+            }
+        }
+    }
+    sys_atomic_add(&pool->waiters, -1);
+    return block;
+}
+
+int lf_pool_free_cnt(lf_pool_t * pool) {
+    return pool->free_cnt + pool->cnt - (int)sys_atomic_load64(&pool->bump);
+}
+
+void lf_pool_free(lf_pool_t * pool, void * block) {
+    lf_push(pool, block);
+    lf_notify(pool);
+}
+
+/**
+ * take a block from the thread's magazine, refill it with half a magazine when empty
+ * never blocks, the hits are published to the pool when it is touched anyway, or every LF_CACHE_PUBLISH hits
+ */
+void * lf_cache_alloc(lf_pool_t * pool, lf_cache_t * cache) {
+    if (!pool->cache_cap) {
+        return lf_pool_alloc(pool, -1);
+    }
+    if (cache->cnt) {
+        // a thread freeing what it allocates may never miss, publish its hits now and then
+        if (++cache->hits == LF_CACHE_PUBLISH) {
+            sys_atomic_add64(&pool->cache_hits, (uint64_t)cache->hits);
+            cache->hits = 0;
+        }
+        return cache->blocks[--cache->cnt];
+    }
+
+    sys_atomic_add64(&pool->cache_hits, (uint64_t)cache->hits);
+    sys_atomic_add64(&pool->cache_misses, 1);
+    cache->hits = 0;
+    cache->cnt = lf_take(pool, cache->blocks, pool->cache_cap / 2);
+    if (!cache->cnt && lf_pool_extend(pool, lf_grow_cnt(pool))) {
+        cache->cnt = lf_take(pool, cache->blocks, pool->cache_cap / 2);
+    }
+    return cache->cnt ? cache->blocks[--cache->cnt] : (void *)0;
+}
+
+/**
+ * put the block back into the thread's magazine, flush half of it when full
+ */
+void lf_cache_free(lf_pool_t * pool, lf_cache_t * cache, void * block) {
+    if (!pool->cache_cap) {
+        lf_pool_free(pool, block);
+        return;
+    }
+    if (cache->cnt >= pool->cache_cap) {
+        int cnt = pool->cache_cap / 2;
+        cache->cnt -= cnt;
+        lf_push_batch(pool, cache->blocks + cache->cnt, cnt);
+        lf_notify(pool);
+    }
+    cache->blocks[cache->cnt++] = block;
+}
+
+/**
+ * give all blocks of the magazine back, for a thread that is about to exit
+ */
+void lf_cache_flush(lf_pool_t * pool, lf_cache_t * cache) {
+    if (cache->cnt) {
+        lf_push_batch(pool, cache->blocks, cache->cnt);
+        cache->cnt = 0;
+        lf_notify(pool);
+    }
+    sys_atomic_add64(&pool->cache_hits, (uint64_t)cache->hits);
+    cache->hits = 0;
+}
+
+void lf_pool_destroy(lf_pool_t * pool) {
+    if (pool->alloc_sem != SYS_SEM_INVALID) {
+        sys_sem_free(pool->alloc_sem);
+        pool->alloc_sem = SYS_SEM_INVALID;
+    }
+    mem_arena_destroy(&pool->arena);
 }
@@ -0,0 +1,65 @@
+#include "net_config.h"
+#include "easy_net_config.h"
+#include "log.h"
+
+#define NET_CONFIG_DEFAULT  {                       \
+    .page_cnt = PACKET_PAGE_CNT,                    \
+    .page_mid_cnt = PACKET_PAGE_MID_CNT,            \
+    .page_big_cnt = PACKET_PAGE_BIG_CNT,            \
+    .packet_cnt = PACKET_BUFFER_SIZE,               \
+    .msg_cnt = HANDLER_BUFFER_SIZE,                 \
+    .socket_cnt = SOCKET_MAX_NR,                    \
+    .raw_cnt = RAW_MAX_NR,                          \
+    .udp_cnt = UDP_MAX_NR,                          \
+    .tcp_cnt = TCP_MAX_NR,                          \
+    .arp_cache_cnt = ARP_CACHE_SIZE,                \
+    .huge_pages = NET_HUGE_PAGES,                   \
+}
+
+static const net_config_t default_config = NET_CONFIG_DEFAULT;
+static net_config_t curr_config = NET_CONFIG_DEFAULT;
+
+/**
+ * the sizes of easy_net_config.h, to be changed by the caller before init_stack
+ */
+void net_config_default(net_config_t * cfg) {
+    *cfg = default_config;
+}
+
+/**
+ * take the sizes for the pools, called before the modules are initialized
+ * */
+net_err_t net_config_set(const net_config_t * cfg) {
+    // every pool needs at least one block
+    const struct {
+        const char * name;
+        int cnt;
+    } cnt_tbl[] = {
+        {"page_cnt", cfg->page_cnt},
+        {"page_mid_cnt", cfg->page_mid_cnt},
+        {"page_big_cnt", cfg->page_big_cnt},
+        {"packet_cnt", cfg->packet_cnt},
+        {"msg_cnt", cfg->msg_cnt},
+        {"socket_cnt", cfg->socket_cnt},
+        {"raw_cnt", cfg->raw_cnt},
+        {"udp_cnt", cfg->udp_cnt},
+        {"tcp_cnt", cfg->tcp_cnt},
+        {"arp_cache_cnt", cfg->arp_cache_cnt},
+    };
+    for (int i = 0; i < (int)(sizeof(cnt_tbl) / sizeof(cnt_tbl[0])); i++) {
+        if (cnt_tbl[i].cnt <= 0) {
+            log_error(LOG_MEMORY_POOL, "config error: %s is %d", cnt_tbl[i].name, cnt_tbl[i].cnt);
+            return NET_ERR_PARAM;
+        }
+    }
+    if (cfg->huge_pages & ~(NET_HUGE_PACKET | NET_HUGE_SOCKET)) {
+        log_error(LOG_MEMORY_POOL, "config error: huge_pages is 0x%x", cfg->huge_pages);
+        return NET_ERR_PARAM;
+    }
+    curr_config = *cfg;
+    return NET_OK;
+}
+
+const net_config_t * net_config(void) {
+    return &curr_config;
+}
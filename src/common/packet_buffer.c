@@ -1,36 +1,139 @@
 ﻿#include "packet_buffer.h"
 #include "memory_pool.h"
 #include "list.h"
-#include "locker.h"
 #include "log.h"
 #include "net_errors.h"
 #include "easy_net_config.h"
 #include "utils.h"
+#include "net_config.h"
 
-static locker_t locker;                    // for allocation and de-allocation
-static memory_pool_t page_pool;            // for page allocation
-static page_t page_buffer[PACKET_PAGE_CNT];
-static memory_pool_t packet_pool;          // for packet allocation
+/**
+ * pages come in several size classes, each with its own pool of page descriptors
+ * and payload memory, the payload of a descriptor is fixed by its place in the pool.
+ * A class configured with more pages than its static memory holds takes its descriptors
+ * and payload from arenas, and grows on demand
+ */
+typedef struct page_class_t {
+    int size;                               // payload size of the pages
+    int cnt;                                // pages in the static memory
+    page_t * pages;
+    uint8_t * mem;                          // cnt * size bytes of payload
+    lf_pool_t pool;
+    uint8_t * payload;                      // payload of the i-th page at payload + i * size, mem or the arena
+    mem_arena_t payload_arena;
+}page_class_t;
+
+static page_t small_pages[PACKET_PAGE_CNT];
+static uint8_t small_mem[PACKET_PAGE_CNT][PACKET_PAGE_SIZE];
+static page_t mid_pages[PACKET_PAGE_MID_CNT];
+static uint8_t mid_mem[PACKET_PAGE_MID_CNT][PACKET_PAGE_MID_SIZE];
+static page_t big_pages[PACKET_PAGE_BIG_CNT];
+static uint8_t big_mem[PACKET_PAGE_BIG_CNT][PACKET_PAGE_BIG_SIZE];
+
+// sorted by size
+static page_class_t page_classes[PAGE_CLASS_CNT] = {
+    {.size = PACKET_PAGE_SIZE, .cnt = PACKET_PAGE_CNT, .pages = small_pages, .mem = small_mem[0]},
+    {.size = PACKET_PAGE_MID_SIZE, .cnt = PACKET_PAGE_MID_CNT, .pages = mid_pages, .mem = mid_mem[0]},
+    {.size = PACKET_PAGE_BIG_SIZE, .cnt = PACKET_PAGE_BIG_CNT, .pages = big_pages, .mem = big_mem[0]},
+};
+
+// pages and packets are allocated and freed by the application, worker and driver threads,
+// so all pools are lock-free
+static lf_pool_t packet_pool;              // for packet allocation
 static packet_t packet_buffer[PACKET_BUFFER_SIZE];
 
-static page_t * page_alloc(void) {
-    locker_lock(&locker);
-    page_t * page = memory_pool_alloc(&page_pool, -1);
-    locker_unlock(&locker);
+#if defined(SYS_THREAD_LOCAL)
+// per-thread magazines, alloc and free stay local to the driver and worker threads
+// and only meet in the pools once every half magazine, sized by each pool (see lf_cache_cap)
+static SYS_THREAD_LOCAL lf_cache_t page_cache[PAGE_CLASS_CNT];
+static SYS_THREAD_LOCAL lf_cache_t packet_cache;
+
+#define page_pool_alloc(cls)        lf_cache_alloc(&page_classes[cls].pool, page_cache + (cls))
+#define page_pool_free(page)        lf_cache_free(&page_classes[(page)->cls].pool, page_cache + (page)->cls, page)
+#define packet_pool_alloc()         lf_cache_alloc(&packet_pool, &packet_cache)
+#define packet_pool_free(pkt)       lf_cache_free(&packet_pool, &packet_cache, pkt)
+#else
+#define page_pool_alloc(cls)        lf_pool_alloc(&page_classes[cls].pool, -1)
+#define page_pool_free(page)        lf_pool_free(&page_classes[(page)->cls].pool, page)
+#define packet_pool_alloc()         lf_pool_alloc(&packet_pool, -1)
+#define packet_pool_free(pkt)       lf_pool_free(&packet_pool, pkt)
+#endif
+
+/**
+ * the descriptor gets its class and payload here rather than at init,
+ * so the descriptors of a large pool are not swept before they are needed
+ */
+static page_t * page_class_alloc(int cls) {
+    page_class_t * pc = page_classes + cls;
+    page_t * page = page_pool_alloc(cls);
+    if (page) {
+        page->cls = cls;
+        page->cap = pc->size;
+        page->payload = pc->payload + (size_t)(page - (page_t *)pc->pool.start) * pc->size;
+    }
+    return page;
+}
+
+/**
+ * allocate a page for size bytes, from the smallest class that holds them all,
+ * a larger class if that one has run out, at last a smaller one and the caller chains more pages
+ */
+static page_t * page_alloc(int size) {
+    int fit = 0;
+    while ((fit < PAGE_CLASS_CNT - 1) && (page_classes[fit].size < size)) {
+        fit++;
+    }
+
+    page_t * page = (page_t *)0;
+    for (int cls = fit; !page && (cls < PAGE_CLASS_CNT); cls++) {
+        page = page_class_alloc(cls);
+    }
+    for (int cls = fit - 1; !page && (cls >= 0); cls--) {
+        page = page_class_alloc(cls);
+    }
 
     if (page) {
         page->size = 0;
+        page->ext = 0;
         page->data = (uint8_t *)0;
+        page->ref = 1;
+        page->origin = (page_t *)0;
+        page->release = (page_release_t)0;
+        page->lent = 0;
         list_node_init(&page->node);
     }
 
     return page;
 }
 
+/**
+ * drop a reference of the page, a shared page also drops the one it holds on its origin
+ */
+static void page_release(page_t * page) {
+    page_t * origin = page->origin;
+    if (sys_atomic_add(&page->ref, -1) == 0) {
+        if (page->release) {
+            page->release(page->release_arg);
+        }
+        page_pool_free(page);
+        if (origin) {
+            page_release(origin);
+        }
+    }
+}
+
+/**
+ * the data of the page is seen by other pages, or lent read only by a driver,
+ * writes must go to a private copy
+ */
+static inline int page_is_shared(page_t * page) {
+    return page->origin || (page->ref > 1) || page->lent;
+}
+
 static void page_free_list(page_t* first) {
     while (first) {
         page_t* next_block = page_next(first);
-        memory_pool_free(&page_pool, first);
+        page_release(first);
         first = next_block;
     }
 }
@@ -38,31 +141,30 @@ static void page_free_list(page_t* first) {
 /**
  * Allocate a list of pages from the page buffer pool
  * when the add_front is 1, the list is allocated using head insertion
- * when the add_front is 0, the list is allocated using tail insertion
+ * when the add_front is 0, the list is allocated using tail insertion,
+ * and the first page keeps headroom bytes free in front of the data
  * */
-static page_t* page_alloc_list(int size, int add_front) {
+static page_t* page_alloc_list(int size, int add_front, int headroom) {
     page_t* first_page = (page_t*)0;
     page_t* pre_page = (page_t*)0;
 
     while (size) {
-        page_t* new_page = page_alloc();
+        page_t* new_page = page_alloc(size + headroom);
         if (!new_page) {
             log_error(LOG_PACKET_BUFFER, "no buffer for alloc(size:%d)", size);
             if (first_page) {
                 // if failed, free all already allocated pages
-                locker_lock(&locker);
                 page_free_list(first_page);
-                locker_unlock(&locker);
             }
             return (page_t*)0;
         }
         int curr_size = 0;
         if (add_front) {
-            curr_size = size > PACKET_PAGE_SIZE ? PACKET_PAGE_SIZE : size;
+            curr_size = size > new_page->cap ? new_page->cap : size;
 
             // head insertion, so the data is close to the end of the payload
             new_page->size = curr_size;
-            new_page->data = new_page->payload + PACKET_PAGE_SIZE - curr_size;
+            new_page->data = new_page->payload + new_page->cap - curr_size;
             if (first_page) {
                 list_node_set_next(&new_page->node, &first_page->node);
             }
@@ -73,10 +175,16 @@ static page_t* page_alloc_list(int size, int add_front) {
                 first_page = new_page;
             }
 
-            curr_size = size > PACKET_PAGE_SIZE ? PACKET_PAGE_SIZE : size;
+            // no room for the headroom if the pools only had a smaller page left
+            if (headroom >= new_page->cap) {
+                headroom = 0;
+            }
+            int room = new_page->cap - headroom;
+            curr_size = size > room ? room : size;
 
             new_page->size = curr_size;
-            new_page->data = new_page->payload;
+            new_page->data = new_page->payload + headroom;
+            headroom = 0;
             if (pre_page) {
                 list_node_set_next(&pre_page->node, &new_page->node);
             }
@@ -122,13 +230,14 @@ void packet_reset_pos(packet_t* packet) {
 }
 
 void packet_inc_ref (packet_t * packet){
-    locker_lock(&locker);
-    packet->ref++;
-    locker_unlock(&locker);
+    sys_atomic_add(&packet->ref, 1);
 }
 
 static inline int curr_page_tail_free(page_t* page) {
-    return PACKET_PAGE_SIZE - (int)(page->data - page->payload) - page->size;
+    if (page->ext || page_is_shared(page)) {
+        return 0;
+    }
+    return page->cap - (int)(page->data - page->payload) - page->size;
 }
 
 #if LOG_DISP_ENABLED(LOG_PACKET_BUFFER)
@@ -143,8 +252,13 @@ static void display_check_buf(packet_t * buf) {
     int total_size = 0, index = 0;
     for (curr = packet_first_page(buf); curr; curr = page_next(curr)) {
         plat_printf("%d: ", index++);
+        if (curr->ext) {
+            plat_printf("Ext:%d b\n", curr->size);
+            total_size += curr->size;
+            continue;
+        }
 
-        if ((curr->data < curr->payload) || (curr->data >= curr->payload + PACKET_PAGE_SIZE)) {
+        if ((curr->data < curr->payload) || (curr->data >= curr->payload + curr->cap)) {
             log_error(LOG_PACKET_BUFFER, "bad page data. ");
         }
 
@@ -159,8 +273,8 @@ static void display_check_buf(packet_t * buf) {
         plat_printf("\n");
 
         int blk_total = pre_size + used_size + free_size;
-        if (blk_total != PACKET_PAGE_SIZE) {
-            log_error(LOG_PACKET_BUFFER,"bad page size. %d != %d", blk_total, PACKET_PAGE_SIZE);
+        if (blk_total != curr->cap) {
+            log_error(LOG_PACKET_BUFFER,"bad page size. %d != %d", blk_total, curr->cap);
         }
         total_size += used_size;
     }
@@ -172,22 +286,110 @@ static void display_check_buf(packet_t * buf) {
 #define display_check_buf(buf)
 #endif
 
+static int cache_hit_rate(lf_pool_t * pool) {
+    uint64_t hits = sys_atomic_load64(&pool->cache_hits);
+    uint64_t total = hits + sys_atomic_load64(&pool->cache_misses);
+    return total ? (int)(hits * 100 / total) : 0;
+}
+
+/**
+ * what the memory of a pool is in, static for the arrays of this file
+ */
+static const char * arena_backing(const mem_arena_t * arena) {
+    return arena->base ? mem_backing_name(arena->backing) : "static";
+}
+
+/**
+ * the free counts do not include the blocks sitting in the per-thread magazines
+ */
 void packet_buffer_mem_stat(void){
-    log_info(LOG_PACKET_BUFFER,"packet buffer mem stat: page_pool:%d/%d, packet_pool:%d/%d",
-        memory_pool_free_cnt(&page_pool), PACKET_PAGE_CNT,
-        memory_pool_free_cnt(&page_pool), PACKET_BUFFER_SIZE);
+    for (int cls = 0; cls < PAGE_CLASS_CNT; cls++) {
+        page_class_t * pc = page_classes + cls;
+        log_info(LOG_PACKET_BUFFER,"packet buffer mem stat: page_pool(%d):%d/%d of %d, cache hit %d%%, %s",
+            pc->size, lf_pool_free_cnt(&pc->pool), pc->pool.cnt, pc->pool.max_cnt, cache_hit_rate(&pc->pool),
+            arena_backing(&pc->payload_arena));
+    }
+    log_info(LOG_PACKET_BUFFER,"packet buffer mem stat: packet_pool:%d/%d of %d, cache hit %d%%, %s",
+        lf_pool_free_cnt(&packet_pool), packet_pool.cnt, packet_pool.max_cnt, cache_hit_rate(&packet_pool),
+        arena_backing(&packet_pool.arena));
+}
+
+/**
+ * give the pages and packets cached by the calling thread back to the pools,
+ * a thread that allocates or frees packets must call it before it exits
+ */
+void packet_buffer_cache_flush(void) {
+#if defined(SYS_THREAD_LOCAL)
+    for (int cls = 0; cls < PAGE_CLASS_CNT; cls++) {
+        lf_cache_flush(&page_classes[cls].pool, page_cache + cls);
+    }
+    lf_cache_flush(&packet_pool, &packet_cache);
+#endif
 }
 
 static void page_free (page_t * page) {
-    memory_pool_free(&page_pool, page);
+    page_release(page);
 }
 
 
+/**
+ * back the payload of the descriptors about to join a growing class
+ */
+static net_err_t page_class_grow(lf_pool_t * pool, int from, int cnt, void * arg) {
+    (void)pool;         // the class is in arg, it knows its payload arena
+    page_class_t * pc = (page_class_t *)arg;
+    return mem_arena_back(&pc->payload_arena, (size_t)(from + cnt) * pc->size);
+}
+
+/**
+ * up to max_cnt pages, in the static memory if they fit and no huge pages are wanted, otherwise
+ * in arenas that start with as many pages as the static memory has. Without arenas the static
+ * memory is all there is
+ */
+static net_err_t page_class_init(page_class_t * pc, int max_cnt, int arena_flags) {
+    lf_pool_destroy(&pc->pool);
+    mem_arena_destroy(&pc->payload_arena);
+
+    if ((max_cnt > pc->cnt) || (arena_flags & MEM_ARENA_HUGE)) {
+        if (mem_arena_init(&pc->payload_arena, (size_t)max_cnt * pc->size, arena_flags) == NET_OK) {
+            pc->payload = pc->payload_arena.base;
+            int cnt = max_cnt < pc->cnt ? max_cnt : pc->cnt;
+            if (lf_pool_init_grow(&pc->pool, sizeof(page_t), cnt, max_cnt, 0, arena_flags, page_class_grow, pc) == NET_OK) {
+                return NET_OK;
+            }
+            mem_arena_destroy(&pc->payload_arena);
+        }
+        if (max_cnt > pc->cnt) {
+            log_warning(LOG_PACKET_BUFFER, "no arena for %d pages of %d, %d pages only", max_cnt, pc->size, pc->cnt);
+            max_cnt = pc->cnt;
+        }
+    }
+
+    pc->payload = pc->mem;
+    return lf_pool_init(&pc->pool, pc->pages, sizeof(page_t), max_cnt, 0);
+}
+
 net_err_t packet_buffer_init(void) {
     log_info(LOG_PACKET_BUFFER,"init packet buffer.");
-    locker_init(&locker, LOCKER_THREAD);
-    memory_pool_init(&page_pool, page_buffer, sizeof(page_t), PACKET_PAGE_CNT, LOCKER_NONE);
-    memory_pool_init(&packet_pool, packet_buffer, sizeof(packet_t), PACKET_BUFFER_SIZE, LOCKER_NONE);
+    // the magazine of this thread must not keep blocks of the pools made again
+    packet_buffer_cache_flush();
+    const net_config_t * cfg = net_config();
+    const int page_cnt[PAGE_CLASS_CNT] = {cfg->page_cnt, cfg->page_mid_cnt, cfg->page_big_cnt};
+    int arena_flags = (cfg->huge_pages & NET_HUGE_PACKET) ? MEM_ARENA_HUGE : 0;
+    for (int cls = 0; cls < PAGE_CLASS_CNT; cls++) {
+        net_err_t err = page_class_init(page_classes + cls, page_cnt[cls], arena_flags);
+        if (err < 0) {
+            log_error(LOG_PACKET_BUFFER, "init page class %d failed.", cls);
+            return err;
+        }
+    }
+
+    lf_pool_destroy(&packet_pool);
+    int packet_cnt = cfg->packet_cnt < PACKET_BUFFER_SIZE ? cfg->packet_cnt : PACKET_BUFFER_SIZE;
+    if (((cfg->packet_cnt <= PACKET_BUFFER_SIZE) && !arena_flags)
+            || (lf_pool_init_grow(&packet_pool, sizeof(packet_t), packet_cnt, cfg->packet_cnt, 0, arena_flags, 0, 0) < 0)) {
+        lf_pool_init(&packet_pool, packet_buffer, sizeof(packet_t), packet_cnt, 0);
+    }
     log_info(LOG_PACKET_BUFFER,"init done.");
     return NET_OK;
 }
@@ -197,9 +399,16 @@ net_err_t packet_buffer_init(void) {
  * Allocate a packet from the packet buffer pool
  * */
 packet_t * packet_alloc(int size){
-    locker_lock(&locker);
-    packet_t * pkt = memory_pool_alloc(&packet_pool, -1);
-    locker_unlock(&locker);
+    return packet_alloc_headroom(size, 0);
+}
+
+/**
+ * Allocate a packet and keep headroom bytes free in front of the data,
+ * so that the headers added later by the lower layers are just a pointer decrement.
+ * An empty packet has no page to keep the headroom in.
+ * */
+packet_t * packet_alloc_headroom(int size, int headroom){
+    packet_t * pkt = packet_pool_alloc();
     if (!pkt) {
         log_error(LOG_PACKET_BUFFER, "no packet available.");
         return (packet_t*)0;
@@ -207,14 +416,17 @@ packet_t * packet_alloc(int size){
 
     pkt->ref = 1;
     pkt->total_size = 0;
+    pkt->csum = PACKET_CSUM_NONE;
+    pkt->csum_start = 0;
+    pkt->hdr_flags = 0;
     init_list(&pkt->page_list);
     list_node_init(&pkt->node);
 
     // allocate the pages
     if (size) {
-        page_t* page = page_alloc_list(size, 0);
+        page_t* page = page_alloc_list(size, 0, headroom);
         if (!page) {
-            memory_pool_free(&packet_pool, pkt);
+            packet_pool_free(pkt);
             return (packet_t*)0;
         }
         packet_insert_page_list(pkt, page, 1);
@@ -236,44 +448,58 @@ net_err_t packet_add_header(packet_t * packet, int size, int cont){
     page_t * page = packet_first_page(packet);
 
     // if the first page has enough space, just add the header
-    int resv_size = (int)(page->data - page->payload);
+    // the room around shared data may be seen by other packets, so it is not used
+    int resv_size = (page->ext || page_is_shared(page)) ? 0 : (int)(page->data - page->payload);
     if (size <= resv_size) {
         page->size += size;
         page->data -= size;
         packet->total_size += size;
+        packet->csum_start += size;
 
+        packet_reset_pos(packet);
         display_check_buf(packet);
         return NET_OK;
     }
 
+    int hdr_size = size;
     if (cont) {
-        // if cont is 1, allocate a new page for the header
-        if (size > PACKET_PAGE_SIZE) {
-            log_error(LOG_PACKET_BUFFER,"is_contious && size too big %d > %d", size, PACKET_PAGE_SIZE);
+        // if cont is 1, allocate a new page for the header, of any class it fits in
+        int max_size = page_classes[PAGE_CLASS_CNT - 1].size;
+        if (size > max_size) {
+            log_error(LOG_PACKET_BUFFER,"is_contious && size too big %d > %d", size, max_size);
             return NET_ERR_SIZE;
         }
 
-        page = page_alloc_list(size, 1);
+        page = page_alloc_list(size, 1, 0);
+        if (page && page_next(page)) {
+            // only smaller pages were left
+            page_free_list(page);
+            page = (page_t *)0;
+        }
         if (!page) {
             log_error(LOG_PACKET_BUFFER,"no buffer for alloc(size:%d)", size);
             return NET_ERR_MEM;
         }
     } else {
-        // if cont is 0, utilize the remaining space in the first page
-        page->data = page->payload;
-        page->size += resv_size;
-        packet->total_size += resv_size;
-        size -= resv_size;
-
-        // then allocate a new page for the rest of the header
-        page = page_alloc_list(size, 1);
+        // if cont is 0, utilize the remaining space in the first page,
+        // once a new page for the rest of the header is allocated
+        page_t * first = page;
+        page = page_alloc_list(size - resv_size, 1, 0);
         if (!page) {
-            log_error(LOG_PACKET_BUFFER,"no buffer for alloc(size:%d)", size);
+            log_error(LOG_PACKET_BUFFER,"no buffer for alloc(size:%d)", size - resv_size);
             return NET_ERR_MEM;
         }
+        if (resv_size) {
+            first->data = first->payload;
+            first->size += resv_size;
+            packet->total_size += resv_size;
+        }
     }
 
     packet_insert_page_list(packet, page, 0);
+    // the data behind the header, and the partial checksum in it, are further from the start
+    packet->csum_start += hdr_size;
+    packet_reset_pos(packet);
     display_check_buf(packet);
     return NET_OK;
 }
@@ -285,6 +511,7 @@ net_err_t packet_add_header(packet_t * packet, int size, int cont){
 net_err_t packet_remove_header(packet_t* packet, int size){
     assert_halt(packet->ref != 0, "packet freed");
     page_t* page = packet_first_page(packet);
+    packet->csum_start -= size;
     while (size) {
         page_t * next_pg = page_next(page);
 
@@ -304,6 +531,7 @@ net_err_t packet_remove_header(packet_t* packet, int size){
         packet->total_size -= curr_size;
         page = next_pg;
     }
+    packet_reset_pos(packet);
     display_check_buf(packet);
     return NET_OK;
 }
@@ -311,6 +539,7 @@ net_err_t packet_remove_header(packet_t* packet, int size){
 
 /**
  * Resize the packet to a new size. Either increase or decrease the size.
+ * Like the other changes to the front or the pages of a packet, this resets the position.
  * */
 net_err_t packet_resize(packet_t * packet, int to_size){
     assert_halt(packet->ref != 0, "packet freed");
@@ -321,7 +550,7 @@ net_err_t packet_resize(packet_t * packet, int to_size){
 
     if (packet->total_size == 0) {
         // if the packet is empty, just call page_alloc_list
-        page_t* page = page_alloc_list(to_size, 0);
+        page_t* page = page_alloc_list(to_size, 0, 0);
         if (!page) {
             log_error(LOG_PACKET_BUFFER, "not enough pages.");
             return NET_ERR_MEM;
@@ -343,7 +572,7 @@ net_err_t packet_resize(packet_t * packet, int to_size){
             packet->total_size += inc_size;
         } else {
             //
-            page_t * new_pg = page_alloc_list(inc_size - remain_size, 0);
+            page_t * new_pg = page_alloc_list(inc_size - remain_size, 0, 0);
             if (!new_pg) {
                 log_error(LOG_PACKET_BUFFER, "not enough pages.");
                 return NET_ERR_MEM;
@@ -380,17 +609,16 @@ net_err_t packet_resize(packet_t * packet, int to_size){
         tail_page->size -= packet->total_size - total_size - to_size;
         packet->total_size = to_size;
     }
+    packet_reset_pos(packet);
     display_check_buf(packet);
     return NET_OK;
 }
 
 void packet_free (packet_t * pkt){
-    locker_lock(&locker);
-    if (--pkt->ref == 0) {
+    if (sys_atomic_add(&pkt->ref, -1) == 0) {
         page_free_list(packet_first_page(pkt));
-        memory_pool_free(&packet_pool, pkt);
+        packet_pool_free(pkt);
     }
-    locker_unlock(&locker);
 }
 
 net_err_t packet_join(packet_t* dest, packet_t* src){
@@ -407,8 +635,79 @@ net_err_t packet_join(packet_t* dest, packet_t* src){
     return NET_OK;
 }
 
+/**
+ * Copy-on-write, replace a shared page of the packet by a private copy of its data.
+ * The first page keeps its data at the end of the payload, so headers can still be added in front.
+ * */
+static page_t * page_unshare(packet_t * packet, page_t * page) {
+    page_t * copy = page_alloc(page->size);
+    if (!copy) {
+        log_error(LOG_PACKET_BUFFER, "no buffer for unshare(size:%d)", page->size);
+        return (page_t *)0;
+    }
+    if (copy->cap < page->size) {
+        log_error(LOG_PACKET_BUFFER, "no page for unshare(size:%d)", page->size);
+        page_release(copy);
+        return (page_t *)0;
+    }
+
+    int first = (page == packet_first_page(packet));
+    copy->size = page->size;
+    copy->data = copy->payload + (first ? copy->cap - page->size : 0);
+    plat_memcpy(copy->data, page->data, page->size);
+    list_insert_after(&packet->page_list, &page->node, &copy->node);
+    list_remove(&packet->page_list, &page->node);
+    if (packet->cur_page == page) {
+        packet->page_offset = copy->data + (packet->page_offset - page->data);
+        packet->cur_page = copy;
+    }
+    page_release(page);
+    return copy;
+}
+
+/**
+ * Copy-on-write of the first size bytes of the first page only, the rest stays shared.
+ * Writing a header into a frame lent by a driver doesn't copy the whole frame.
+ * */
+static page_t * page_unshare_head(packet_t * packet, page_t * page, int size) {
+    if (size >= page->size) {
+        return page_unshare(packet, page);
+    }
+
+    page_t * head = page_alloc(size);
+    if (!head) {
+        log_error(LOG_PACKET_BUFFER, "no buffer for unshare(size:%d)", size);
+        return (page_t *)0;
+    }
+    if (head->cap < size) {
+        log_error(LOG_PACKET_BUFFER, "no page for unshare(size:%d)", size);
+        page_release(head);
+        return (page_t *)0;
+    }
+
+    head->size = size;
+    head->data = head->payload + head->cap - size;
+    plat_memcpy(head->data, page->data, size);
+    page->data += size;
+    page->size -= size;
+    list_insert_first(&packet->page_list, &head->node);
+    packet_reset_pos(packet);
+    return head;
+}
+
+/**
+ * make sure the page at the current position can be written
+ * */
+static inline net_err_t packet_own_curr(packet_t * packet) {
+    if (page_is_shared(packet->cur_page) && !page_unshare(packet, packet->cur_page)) {
+        return NET_ERR_MEM;
+    }
+    return NET_OK;
+}
+
 /**
  * Make the first size bytes of the packet continuous.
+ * The caller writes the header through packet_data() afterwards, so the first page is made private.
  * **/
 net_err_t packet_set_cont(packet_t* buf, int size){
     assert_halt(buf->ref != 0, "packet freed")
@@ -418,18 +717,26 @@ net_err_t packet_set_cont(packet_t* buf, int size){
         return NET_ERR_SIZE;
     }
 
-    if (size > PACKET_PAGE_SIZE) {
-        log_error(LOG_PACKET_BUFFER,"size too big > %d", LOG_PACKET_BUFFER);
-        return NET_ERR_SIZE;
+    page_t * first_pg = packet_first_page(buf);
+    if (page_is_shared(first_pg)) {
+        first_pg = page_unshare_head(buf, first_pg, size);
+        if (!first_pg) {
+            return NET_ERR_MEM;
+        }
     }
 
     // if it is already continuous, do nothing
-    page_t * first_pg = packet_first_page(buf);
     if (size <= first_pg->size) {
+        packet_reset_pos(buf);
         display_check_buf(buf);
         return NET_OK;
     }
 
+    if (size > first_pg->cap) {
+        log_error(LOG_PACKET_BUFFER,"size too big > %d", first_pg->cap);
+        return NET_ERR_SIZE;
+    }
+
 #if 0
     uint8_t * dest = first_pg->payload + PKTBUF_BLK_SIZE - size;
     plat_memmove(dest, first_pg->data, first_pg->size);
@@ -440,7 +747,9 @@ net_err_t packet_set_cont(packet_t* buf, int size){
     for (int i = 0; i < first_pg->size; i++) {
         *dest++ = first_pg->data[i];
     }
+    // an external page becomes a normal one once its data is pulled into payload
     first_pg->data = first_pg->payload;
+    first_pg->ext = 0;
 #endif
 
     int remain_size = size - first_pg->size;
@@ -461,11 +770,186 @@ net_err_t packet_set_cont(packet_t* buf, int size){
             curr_blk = next_pg;
         }
     }
+    packet_reset_pos(buf);
     display_check_buf(buf);
     return NET_OK;
 }
 
 
+/**
+ * Append size bytes at data to the end of the packet without copying.
+ * The memory is referenced by an external page and must stay valid until the packet is freed.
+ * */
+net_err_t packet_add_ext(packet_t * packet, const uint8_t * data, int size) {
+    assert_halt(packet->ref != 0, "packet freed");
+    if (!data || (size <= 0)) {
+        return NET_ERR_PARAM;
+    }
+
+    // the payload of an external page is unused, take the smallest class
+    page_t * page = page_alloc(0);
+    if (!page) {
+        log_error(LOG_PACKET_BUFFER, "no buffer for ext page(size:%d)", size);
+        return NET_ERR_MEM;
+    }
+    page->ext = 1;
+    page->data = (uint8_t *)data;
+    page->size = size;
+    packet_insert_page_list(packet, page, 1);
+    display_check_buf(packet);
+    return NET_OK;
+}
+
+
+/**
+ * Find the page holding offset, 0 <= offset < total_size, and where offset is in it.
+ * The walk starts from the nearest of the first page, the current page and the last page,
+ * so moving around the current position or close to either end takes a step or two
+ * whatever the number of pages. pos is not changed.
+ * */
+static page_t * packet_locate(packet_t * packet, int offset, int * page_off) {
+    page_t * page = packet_first_page(packet);
+    int start = 0, dist = offset;
+
+    page_t * last = packet_last_page(packet);
+    if (packet->total_size - offset < dist) {
+        page = last;
+        start = packet->total_size - last->size;
+        dist = packet->total_size - offset;
+    }
+    if (packet->cur_page) {
+        int cur_start = packet->pos - (int)(packet->page_offset - packet->cur_page->data);
+        int cur_dist = offset >= cur_start ? offset - cur_start : cur_start - offset;
+        if (cur_dist < dist) {
+            page = packet->cur_page;
+            start = cur_start;
+        }
+    }
+
+    while (offset < start) {
+        page = page_prev(page);
+        start -= page->size;
+    }
+    while (offset >= start + page->size) {
+        start += page->size;
+        page = page_next(page);
+    }
+    *page_off = offset - start;
+    return page;
+}
+
+/**
+ * A new packet holding size bytes of src starting at offset, without copying them.
+ * The pages of the clone share the payload of the pages of src, both packets can be freed
+ * in any order, and whichever writes into shared data first gets a private copy of that page.
+ * */
+packet_t * packet_clone(packet_t * src, int offset, int size) {
+    assert_halt(src->ref != 0, "packet freed");
+    if ((offset < 0) || (size < 0) || (offset + size > src->total_size)) {
+        log_error(LOG_PACKET_BUFFER, "clone range error: %d + %d > %d", offset, size, src->total_size);
+        return (packet_t *)0;
+    }
+
+    packet_t * pkt = packet_alloc(0);
+    if (!pkt) {
+        return (packet_t *)0;
+    }
+
+    page_t * page = (page_t *)0;
+    if (size) {
+        page = packet_locate(src, offset, &offset);
+    }
+    for (; size && page; page = page_next(page), offset = 0) {
+        int curr_size = page->size - offset;
+        curr_size = curr_size > size ? size : curr_size;
+
+        // the payload of the descriptor is unused, take the smallest class
+        page_t * shared = page_alloc(0);
+        if (!shared) {
+            log_error(LOG_PACKET_BUFFER, "no buffer for clone(size:%d)", size);
+            packet_free(pkt);
+            return (packet_t *)0;
+        }
+        shared->ext = 1;
+        shared->data = page->data + offset;
+        shared->size = curr_size;
+        // a page of caller memory has no payload to keep alive, unless it has to be released
+        if (!page->ext || page->origin || page->release) {
+            shared->origin = page->origin ? page->origin : page;
+            sys_atomic_add(&shared->origin->ref, 1);
+        }
+        list_insert_last(&pkt->page_list, &shared->node);
+        pkt->total_size += curr_size;
+        size -= curr_size;
+    }
+    packet_reset_pos(pkt);
+    display_check_buf(pkt);
+    return pkt;
+}
+
+
+/**
+ * Complete a partial checksum in software, for a netif whose driver can't do it.
+ * The field holds the sum of the pseudo header, summing it with the data gives the checksum.
+ * */
+net_err_t packet_csum_finish(packet_t * packet) {
+    if (packet->csum != PACKET_CSUM_PARTIAL) {
+        return NET_OK;
+    }
+
+    uint16_t checksum = packet_checksum16_at(packet, packet->csum_start, packet->total_size - packet->csum_start, 0, 1);
+    packet_seek(packet, packet->csum_start + packet->csum_offset);
+    net_err_t err = packet_write(packet, (uint8_t *)&checksum, sizeof(checksum));
+    if (err < 0) {
+        log_error(LOG_PACKET_BUFFER, "write checksum failed");
+        return err;
+    }
+    packet->csum = PACKET_CSUM_NONE;
+    return NET_OK;
+}
+
+/**
+ * A packet of size bytes at data, a receive buffer lent by a driver.
+ * No copy is made, release(arg) is called once neither the packet nor any clone of it
+ * references the memory any more, or once the packet is detached from it.
+ * */
+packet_t * packet_alloc_ext(const uint8_t * data, int size, page_release_t release, void * arg) {
+    packet_t * pkt = packet_alloc(0);
+    if (!pkt) {
+        return (packet_t *)0;
+    }
+    if (packet_add_ext(pkt, data, size) < 0) {
+        packet_free(pkt);
+        return (packet_t *)0;
+    }
+    page_t * page = packet_first_page(pkt);
+    page->release = release;
+    page->release_arg = arg;
+    page->lent = 1;
+    packet_reset_pos(pkt);
+    return pkt;
+}
+
+/**
+ * Copy the data lent by a driver into pool pages and release it.
+ * Called before a packet is queued for an unknown time, so the driver gets its buffer back.
+ * */
+net_err_t packet_detach(packet_t * packet) {
+    page_t * page = packet_first_page(packet);
+    while (page) {
+        page_t * next = page_next(page);
+        if (page->lent || (page->origin && page->origin->lent)) {
+            if (!page_unshare(packet, page)) {
+                return NET_ERR_MEM;
+            }
+        }
+        page = next;
+    }
+    packet_reset_pos(packet);
+    return NET_OK;
+}
+
+
 static int curr_page_remain(packet_t * packet) {
     page_t* page = packet->cur_page;
     if (!page) {
@@ -506,27 +990,54 @@ net_err_t packet_seek(packet_t* packet, int offset){
         return NET_ERR_SIZE;
     }
 
-    int move_bytes;
-    if (offset < packet->pos) {
-        // move backward is a bit hard, here we just reset the position, and move forward
-        packet->cur_page = packet_first_page(packet);
-        packet->page_offset = packet->cur_page->data;
-        packet->pos = 0;
+    int page_off;
+    packet->cur_page = packet_locate(packet, offset, &page_off);
+    packet->page_offset = packet->cur_page->data + page_off;
+    packet->pos = offset;
+    return NET_OK;
+}
 
-        move_bytes = offset;
-    } else {
-        move_bytes = offset - packet->pos;
+/**
+ * Start reading size bytes from offset span by span, the pos of the packet is left alone.
+ * */
+net_err_t packet_iter_init(packet_t * packet, packet_iter_t * iter, int offset, int size) {
+    assert_halt(packet->ref != 0, "packet freed")
+    if ((offset < 0) || (size < 0) || (offset + size > packet->total_size)) {
+        log_error(LOG_PACKET_BUFFER, "iter range error: %d + %d > %d", offset, size, packet->total_size);
+        return NET_ERR_SIZE;
     }
 
-    while (move_bytes) {
-        int remain_size = curr_page_remain(packet);
-        int curr_move = move_bytes > remain_size ? remain_size : move_bytes;
-        move_forward(packet, curr_move);
-        move_bytes -= curr_move;
+    iter->page = (page_t *)0;
+    iter->page_off = 0;
+    iter->remain = size;
+    if (size) {
+        iter->page = packet_locate(packet, offset, &iter->page_off);
     }
     return NET_OK;
 }
 
+/**
+ * The next continuous span of the range, returns its size, 0 once the range is done.
+ * */
+int packet_iter_next(packet_iter_t * iter, uint8_t ** data) {
+    if (!iter->remain) {
+        return 0;
+    }
+
+    page_t * page = iter->page;
+    int size = page->size - iter->page_off;
+    size = size > iter->remain ? iter->remain : size;
+    *data = page->data + iter->page_off;
+
+    iter->remain -= size;
+    iter->page_off += size;
+    if ((iter->page_off >= page->size) && iter->remain) {
+        iter->page = page_next(page);
+        iter->page_off = 0;
+    }
+    return size;
+}
+
 /**
  * Bytes remain starting from the current position.
  * */
@@ -538,6 +1049,16 @@ static inline int total_packet_remain(packet_t* packet) {
  * write beginning from the current position
  * */
 int packet_write(packet_t * packet, uint8_t* src, int size){
+    return packet_write_csum(packet, src, size, (uint32_t *)0);
+}
+
+/**
+ * Write like packet_write, and add the 16-bit one's complement sum of the written bytes to *sum,
+ * each chunk is summed right after it is copied, while it is still in the cache.
+ * The bytes are summed at their position in the packet, prepending headers of even size keeps
+ * the sum valid for the final packet.
+ * */
+int packet_write_csum(packet_t * packet, uint8_t* src, int size, uint32_t * sum){
     assert_halt(packet->ref != 0, "packet freed")
     if (!src || !size) {
         return NET_ERR_PARAM;
@@ -550,9 +1071,15 @@ int packet_write(packet_t * packet, uint8_t* src, int size){
     }
 
     while (size > 0) {
+        if (packet_own_curr(packet) < 0) {
+            return NET_ERR_MEM;
+        }
         int page_size = curr_page_remain(packet);
         int curr_copy = size > page_size ? page_size : size;
         plat_memcpy(packet->page_offset, src, curr_copy);
+        if (sum) {
+            *sum = checksum16(packet->pos, packet->page_offset, curr_copy, *sum, 0);
+        }
         move_forward(packet, curr_copy);
         src += curr_copy;
         size -= curr_copy;
@@ -597,6 +1124,9 @@ net_err_t packet_copy(packet_t * dest, packet_t* src, int size){
         return NET_ERR_SIZE;
     }
     while (size) {
+        if (packet_own_curr(dest) < 0) {
+            return NET_ERR_MEM;
+        }
         int dest_remain = curr_page_remain(dest);
         int src_remain = curr_page_remain(src);
         int copy_size = dest_remain > src_remain ? src_remain : dest_remain;
@@ -626,6 +1156,9 @@ net_err_t packet_fill(packet_t* packet, uint8_t val, int size){
         return NET_ERR_SIZE;
     }
     while (size > 0) {
+        if (packet_own_curr(packet) < 0) {
+            return NET_ERR_MEM;
+        }
         int blk_size = curr_page_remain(packet);
         int curr_fill = size > blk_size ? blk_size : size;
         plat_memset(packet->page_offset, val, curr_fill);
@@ -652,7 +1185,7 @@ uint16_t packet_checksum16(packet_t* buf, int size, uint32_t pre_sum, int comple
         int curr_size = (blk_size > size ? size : blk_size);
         sum = checksum16(offset, buf->page_offset, curr_size, sum, 0);
 
-        assert_halt(buf->page_offset + curr_size <= buf->cur_page->data + PACKET_PAGE_SIZE, "out bound");
+        assert_halt(buf->page_offset + curr_size <= buf->cur_page->data + buf->cur_page->size, "out bound");
 
         move_forward(buf, curr_size);
         size -= curr_size;
@@ -660,3 +1193,23 @@ uint16_t packet_checksum16(packet_t* buf, int size, uint32_t pre_sum, int comple
     }
     return complement ? (uint16_t)~sum : (uint16_t)sum;
 }
+
+/**
+ * checksum of size bytes from offset, without moving pos
+ * */
+uint16_t packet_checksum16_at(packet_t * packet, int offset, int size, uint32_t pre_sum, int complement) {
+    packet_iter_t iter;
+    if (packet_iter_init(packet, &iter, offset, size) < 0) {
+        return 0;
+    }
+
+    uint32_t sum = pre_sum;
+    uint32_t sum_off = 0;
+    uint8_t * data;
+    int curr_size;
+    while ((curr_size = packet_iter_next(&iter, &data)) > 0) {
+        sum = checksum16(sum_off, data, curr_size, sum, 0);
+        sum_off += curr_size;
+    }
+    return complement ? (uint16_t)~sum : (uint16_t)sum;
+}
@@ -1,6 +1,7 @@
 ﻿#include "utils.h"
 #include "log.h"
 #include "ipaddr.h"
+#include "sys_plat.h"
 
 static int is_little_endian(void) {
     // big endian：0x12, 0x34; small endian：0x34, 0x12
@@ -20,34 +21,182 @@ net_err_t utils_init(void) {
         log_error(LOG_UTILS, "check endian faild.");
         return NET_ERR_SYS;
     }
+    log_info(LOG_UTILS, "checksum kernel: %d", checksum_impl());
     log_info(LOG_UTILS, "done.");
     return NET_OK;
 }
 
 
+#if NET_CHECKSUM_SIMD && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)) \
+        && !defined(SYS_PLAT_X86OS)
+#define CHECKSUM_X86        1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CHECKSUM_TARGET(isa)
+#else
+#include <cpuid.h>
+#define CHECKSUM_TARGET(isa)        __attribute__((target(isa)))
+#endif
+#else
+#define CHECKSUM_X86        0
+#endif
+
 /**
- * https://www.youtube.com/watch?v=_zMf4KYoKbM
+ * Sum of the buffer as little endian 16-bit words, an odd last byte is the low byte of a word.
+ * The kernels add 32-bit words into 64-bit accumulators, so no carry is lost and folding
+ * the result with end-around carry gives the same 16-bit sum.
  * */
-uint16_t checksum16(uint32_t offset, void* buf, uint16_t len, uint32_t pre_sum, int complement) {
-    uint16_t* curr_buf = (uint16_t *)buf;
-    uint32_t checksum = pre_sum;
-    if (offset & 0x1) {
-        uint8_t * buf = (uint8_t *)curr_buf;
-        checksum += *buf++ << 8;
-        curr_buf = (uint16_t *)buf;
-        len--;
-    }
+typedef uint64_t (*checksum_kernel_t)(const uint8_t * buf, int len);
 
+static uint64_t checksum_generic(const uint8_t * buf, int len) {
+    uint64_t sum0 = 0, sum1 = 0;
+    while (len >= 8) {
+        uint32_t w[2];
+        plat_memcpy(w, buf, 8);
+        sum0 += w[0];
+        sum1 += w[1];
+        buf += 8;
+        len -= 8;
+    }
+    sum0 += sum1;
     while (len > 1) {
-        checksum += *curr_buf++;
+        sum0 += (uint32_t)buf[0] | ((uint32_t)buf[1] << 8);
+        buf += 2;
         len -= 2;
     }
-
     if (len > 0) {
-        checksum += *(uint8_t*)curr_buf;
+        sum0 += buf[0];
+    }
+    return sum0;
+}
+
+#if CHECKSUM_X86
+CHECKSUM_TARGET("sse2")
+static uint64_t checksum_sse2(const uint8_t * buf, int len) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero;
+    while (len >= 32) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)buf);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(buf + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+        buf += 32;
+        len -= 32;
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + checksum_generic(buf, len);
+}
+
+CHECKSUM_TARGET("avx2")
+static uint64_t checksum_avx2(const uint8_t * buf, int len) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero;
+    while (len >= 64) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)buf);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(buf + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+        buf += 64;
+        len -= 64;
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + checksum_generic(buf, len);
+}
+
+static int cpu_has(checksum_impl_t impl) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    if (impl == CHECKSUM_SSE2) {
+        return (info[3] >> 26) & 1;
+    }
+    // avx2 needs the os to save the ymm registers
+    if (!((info[2] >> 27) & 1) || !((info[2] >> 28) & 1) || ((_xgetbv(0) & 0x6) != 0x6) || (max_leaf < 7)) {
+        return 0;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] >> 5) & 1;
+#else
+    __builtin_cpu_init();
+    return (impl == CHECKSUM_SSE2) ? __builtin_cpu_supports("sse2") : __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static checksum_kernel_t checksum_kernel_of(checksum_impl_t impl) {
+    switch (impl) {
+#if CHECKSUM_X86
+        case CHECKSUM_SSE2:
+            return cpu_has(CHECKSUM_SSE2) ? checksum_sse2 : (checksum_kernel_t)0;
+        case CHECKSUM_AVX2:
+            return cpu_has(CHECKSUM_AVX2) ? checksum_avx2 : (checksum_kernel_t)0;
+#endif
+        case CHECKSUM_GENERIC:
+            return checksum_generic;
+        default:
+            return (checksum_kernel_t)0;
+    }
+}
+
+static checksum_kernel_t checksum_kernel = (checksum_kernel_t)0;
+static checksum_impl_t checksum_kernel_impl = CHECKSUM_GENERIC;
+
+/**
+ * pick the kernel, normally the best one the cpu supports.
+ * NET_ERR_SYS if the cpu doesn't support it
+ * */
+net_err_t checksum_use(checksum_impl_t impl) {
+    checksum_kernel_t kernel = checksum_kernel_of(impl);
+    if (!kernel) {
+        return NET_ERR_SYS;
     }
-    uint16_t high;
-    while ((high = checksum >> 16) != 0) {
+    checksum_kernel = kernel;
+    checksum_kernel_impl = impl;
+    return NET_OK;
+}
+
+checksum_impl_t checksum_impl(void) {
+    if (!checksum_kernel) {
+        if ((checksum_use(CHECKSUM_AVX2) < 0) && (checksum_use(CHECKSUM_SSE2) < 0)) {
+            checksum_use(CHECKSUM_GENERIC);
+        }
+    }
+    return checksum_kernel_impl;
+}
+
+/**
+ * https://www.youtube.com/watch?v=_zMf4KYoKbM
+ * offset is the position of buf in the data being summed, an odd offset means the first byte
+ * is the high byte of a 16-bit word.
+ * */
+uint16_t checksum16(uint32_t offset, void* buf, uint16_t len, uint32_t pre_sum, int complement) {
+    if (!checksum_kernel) {
+        checksum_impl();
+    }
+
+    const uint8_t * curr_buf = (const uint8_t *)buf;
+    uint64_t checksum = pre_sum;
+    if ((offset & 0x1) && (len > 0)) {
+        checksum += (uint32_t)*curr_buf++ << 8;
+        len--;
+    }
+    checksum += checksum_kernel(curr_buf, len);
+
+    checksum = (checksum & 0xffffffff) + (checksum >> 32);
+    checksum = (checksum & 0xffffffff) + (checksum >> 32);
+    uint32_t high;
+    while ((high = (uint32_t)(checksum >> 16)) != 0) {
         checksum = high + (checksum & 0xffff);
     }
 
@@ -57,17 +206,49 @@ uint16_t checksum16(uint32_t offset, void* buf, uint16_t len, uint32_t pre_sum,
 
 
 uint16_t checksum_peso(const uint8_t * src_ip, const uint8_t* dest_ip, uint8_t protocol, packet_t * buf) {
+    return checksum_peso_part(src_ip, dest_ip, protocol, buf, buf->total_size, 0);
+}
+
+/**
+ * checksum with the pseudo header, where only the first size bytes of buf are summed here,
+ * the sum of the rest is data_sum, taken while the data was written (packet_write_csum)
+ * */
+uint16_t checksum_peso_part(const uint8_t * src_ip, const uint8_t* dest_ip, uint8_t protocol, packet_t * buf, int size, uint32_t data_sum) {
     uint8_t zero_protocol[2] = { 0, protocol };
     uint16_t len = e_htons(buf->total_size);
     int offset = 0;
-    uint32_t sum = checksum16(offset, (uint16_t*)src_ip, IPV4_ADDR_SIZE, 0, 0);
+    uint32_t sum = checksum16(offset, (uint16_t*)src_ip, IPV4_ADDR_SIZE, data_sum, 0);
     offset += IPV4_ADDR_SIZE;
     sum = checksum16(offset, (uint16_t*)dest_ip, IPV4_ADDR_SIZE, sum, 0);
     offset += IPV4_ADDR_SIZE;
     sum = checksum16(offset, (uint16_t*)zero_protocol, 2, sum, 0);
     offset += 2;
     sum = checksum16(offset, (uint16_t*)&len, 2, sum, 0);
-    packet_reset_pos(buf);
-    sum = packet_checksum16(buf, buf->total_size, sum, 1);
+    sum = packet_checksum16_at(buf, 0, size, sum, 1);
     return sum;
-}
\ No newline at end of file
+}
+
+/**
+ * verify a received transport segment starting at the current packet start, 0 if it is correct.
+ * what the driver knows is used: nothing to do, or only the pseudo header to add
+ * */
+uint16_t checksum_peso_in(const uint8_t * src_ip, const uint8_t* dest_ip, uint8_t protocol, packet_t * buf) {
+    switch (buf->csum) {
+        case PACKET_CSUM_UNNECESSARY:
+            return 0;
+        case PACKET_CSUM_COMPLETE:
+            return checksum_peso_part(src_ip, dest_ip, protocol, buf, 0, buf->csum_value);
+        default:
+            return checksum_peso(src_ip, dest_ip, protocol, buf);
+    }
+}
+
+/**
+ * instead of summing the segment, put the sum of the pseudo header in the checksum field
+ * and leave the rest to the driver, or to netif_put_out if the driver can't
+ * */
+void checksum_peso_defer(const uint8_t * src_ip, const uint8_t* dest_ip, uint8_t protocol, packet_t * buf, uint16_t * field) {
+    *field = 0;
+    *field = (uint16_t)~checksum_peso_part(src_ip, dest_ip, protocol, buf, 0, 0);
+    packet_csum_partial(buf, (int)((uint8_t *)field - packet_data(buf)));
+}
@@ -4,15 +4,33 @@
 #include "netif_pcap.h"
 #include "log.h"
 
+#if NETIF_PCAP_ZERO_COPY
+/**
+ * the stack is done with the frame, the pcap buffer can be reused
+ * */
+static void pcap_frame_release(void * arg) {
+    sys_sem_notify((sys_sem_t)arg);
+}
+#endif
+
 /**
  * Listen on physical network interface and receive packets.
  * When a packet is received, put a new message o handler thread via msg queue.
  * When failed, free the packet. When success, handler thread will free the packet.
+ * In zero copy mode the packet refers to the pcap buffer, which is only valid until the next
+ * pcap_next_ex(), so the thread waits until the stack releases the frame before reading the next one.
  * */
 void recv_thread(void* arg) {
     plat_printf("recv thread start running...\n");
     netif_t* netif = (netif_t*)arg;
     pcap_t* pcap = (pcap_t*)netif->ops_data;
+#if NETIF_PCAP_ZERO_COPY
+    sys_sem_t frame_sem = sys_sem_create(0);
+    if (frame_sem == SYS_SEM_INVALID) {
+        log_error(LOG_NETIF, "create frame sem failed");
+        return;
+    }
+#endif
     while (1) {
         // 1 - success, 0 - no packets，others - error
         struct pcap_pkthdr* pkthdr;
@@ -21,6 +39,17 @@ void recv_thread(void* arg) {
             continue;
         }
 
+#if NETIF_PCAP_ZERO_COPY
+        packet_t* lent = packet_alloc_ext(pkt_data, pkthdr->len, pcap_frame_release, (void *)frame_sem);
+        if (lent != (packet_t*)0) {
+            if (netif_put_in(netif, lent, 0) < 0) {
+                log_warning(LOG_NETIF, "netif %s in_q full", netif->name);
+                packet_free(lent);
+            }
+            sys_sem_wait(frame_sem, 0);
+            continue;
+        }
+#endif
         // convert pcap_pkthdr to packet_t
         packet_t* packet = packet_alloc(pkthdr->len);
         if (packet == (packet_t*)0) {
@@ -93,6 +93,51 @@ void sys_mutex_unlock(sys_mutex_t locker) {
     ReleaseMutex(locker);
 }
 
+int sys_atomic_add(volatile int * ptr, int val) {
+    return (int)InterlockedAdd((volatile LONG *)ptr, val);
+}
+
+uint64_t sys_atomic_load64(volatile uint64_t * ptr) {
+    return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)ptr, 0, 0);
+}
+
+uint64_t sys_atomic_add64(volatile uint64_t * ptr, uint64_t val) {
+    return (uint64_t)InterlockedAdd64((volatile LONG64 *)ptr, (LONG64)val);
+}
+
+int sys_atomic_cas64(volatile uint64_t * ptr, uint64_t expect, uint64_t desired) {
+    return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)ptr, (LONG64)desired, (LONG64)expect) == expect;
+}
+
+void * sys_mem_reserve(size_t size) {
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+int sys_mem_commit(void * addr, size_t size) {
+    return VirtualAlloc(addr, size, MEM_COMMIT, PAGE_READWRITE) ? 0 : -1;
+}
+
+void sys_mem_release(void * addr, size_t size) {
+    VirtualFree(addr, 0, MEM_RELEASE);
+}
+
+size_t sys_mem_page_size(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+}
+
+/**
+ * large pages need the lock pages privilege, without it this fails and the caller falls back
+ */
+void * sys_mem_map_huge(size_t size) {
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+}
+
+void * sys_mem_reserve_huge(size_t size) {
+    return (void *)0;
+}
+
 sys_thread_t sys_thread_create(void (*entry)(void * arg), void* arg) {
     return CreateThread(
         NULL,                           // SD
@@ -132,6 +177,7 @@ void sys_plat_init(void) {
 #include <unistd.h>
 #include <semaphore.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 
 int load_pcap_lib(void) {
     return 0;
@@ -274,6 +320,85 @@ void sys_mutex_unlock(sys_mutex_t locker) {
     pthread_mutex_unlock(locker);
 }
 
+int sys_atomic_add(volatile int * ptr, int val) {
+    return __atomic_add_fetch(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+uint64_t sys_atomic_load64(volatile uint64_t * ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+uint64_t sys_atomic_add64(volatile uint64_t * ptr, uint64_t val) {
+    return __atomic_add_fetch(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+int sys_atomic_cas64(volatile uint64_t * ptr, uint64_t expect, uint64_t desired) {
+    return __atomic_compare_exchange_n(ptr, &expect, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * the reserved range takes no memory until it is committed, nor does it count against overcommit
+ */
+void * sys_mem_reserve(size_t size) {
+    void * addr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return addr == MAP_FAILED ? (void *)0 : addr;
+}
+
+int sys_mem_commit(void * addr, size_t size) {
+    return mprotect(addr, size, PROT_READ | PROT_WRITE);
+}
+
+void sys_mem_release(void * addr, size_t size) {
+    munmap(addr, size);
+}
+
+size_t sys_mem_page_size(void) {
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * huge pages from the pool reserved through /sys/kernel/mm/hugepages, the mapping
+ * reserves all it needs, so it fails here rather than on a later page fault
+ */
+void * sys_mem_map_huge(size_t size) {
+#if defined(MAP_HUGETLB)
+    void * addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    return addr == MAP_FAILED ? (void *)0 : addr;
+#else
+    return (void *)0;
+#endif
+}
+
+/**
+ * a reserved range aligned to the huge page size, that the kernel backs with transparent huge pages
+ * as its huge page sized pieces are committed and touched
+ */
+void * sys_mem_reserve_huge(size_t size) {
+#if defined(MADV_HUGEPAGE)
+    size_t map_size = size + SYS_MEM_HUGE_PAGE_SIZE;
+    uint8_t * map = (uint8_t *)sys_mem_reserve(map_size);
+    if (!map) {
+        return (void *)0;
+    }
+
+    // trim the range to its aligned part
+    uint8_t * addr = (uint8_t *)(((uintptr_t)map + SYS_MEM_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(SYS_MEM_HUGE_PAGE_SIZE - 1));
+    if (addr > map) {
+        munmap(map, addr - map);
+    }
+    if (map + map_size > addr + size) {
+        munmap(addr + size, map + map_size - (addr + size));
+    }
+    if (madvise(addr, size, MADV_HUGEPAGE) < 0) {
+        munmap(addr, size);
+        return (void *)0;
+    }
+    return addr;
+#else
+    return (void *)0;
+#endif
+}
+
 
 void sys_thread_exit (int error) {
     //
@@ -2,28 +2,9 @@
 #include "ping.h"
 #include "sys_plat.h"
 #include "net_api.h"
+#include "utils.h"
 
 
-static uint16_t checksum(void* buf, uint16_t len) {
-    uint16_t* curr_buf = (uint16_t*)buf;
-    uint32_t checksum = 0;
-
-    while (len > 1) {
-        checksum += *curr_buf++;
-        len -= 2;
-    }
-
-    if (len > 0) {
-        checksum += *(uint8_t*)curr_buf;
-    }
-    uint16_t high;
-    while ((high = checksum >> 16) != 0) {
-        checksum = high + (checksum & 0xffff);
-    }
-
-    return (uint16_t)~checksum;
-}
-
 /**
  * simple ping request
  */
@@ -77,7 +58,7 @@ void ping_run(ping_t * ping, const char* dest, int count, int size, int interval
         ping->req.echo_hdr.code = 0;
         ping->req.time = clock();        // current time before send
         ping->req.echo_hdr.checksum = 0;
-        ping->req.echo_hdr.checksum = checksum(&ping->req, total_size);
+        ping->req.echo_hdr.checksum = checksum16(0, &ping->req, total_size, 0, 1);
 
 #ifdef USE_CONNECT
         ssize_t size = send(sk, (const char*)&ping->req, total_size, 0);
@@ -74,19 +74,38 @@ static net_err_t validate_frame_format(ether_frame_t * frame, int total_size) {
     return NET_OK;
 }
 
-static net_err_t ether_in(netif_t* netif, packet_t* packet) {
-    log_info(LOG_ETHER, "ether in:");
-    packet_set_cont(packet, sizeof(ether_hdr_t));
+/**
+ * check the frame and fill the link layer part of the parsed headers
+ * */
+static net_err_t ether_parse(netif_t* netif, packet_t* packet) {
+    (void)netif;        // every ethernet netif parses the same way
+    net_err_t err = packet_set_cont(packet, sizeof(ether_hdr_t));
+    if (err < 0) {
+        log_error(LOG_ETHER, "ether frame too small: %d", packet->total_size);
+        return err;
+    }
 
     ether_frame_t* pkt = (ether_frame_t*)packet_data(packet);
-    net_err_t err;
     if ((err = validate_frame_format(pkt, packet->total_size)) != NET_OK) {
         log_error(LOG_ETHER, "ether frame error");
         return err;
     }
+    packet->l2_len = sizeof(ether_hdr_t);
+    packet->l3_proto = e_ntohs(pkt->hdr.protocol);
+    packet->hdr_flags |= PACKET_HDR_L2;
+    return NET_OK;
+}
+
+static net_err_t ether_in(netif_t* netif, packet_t* packet) {
+    log_info(LOG_ETHER, "ether in:");
+    net_err_t err;
+    // normally done by netif_parse
+    if (!(packet->hdr_flags & PACKET_HDR_L2) && ((err = ether_parse(netif, packet)) < 0)) {
+        return err;
+    }
 
-    display_ether_display("ether in", pkt, packet->total_size);
-    switch (e_ntohs(pkt->hdr.protocol)) {
+    display_ether_display("ether in", (ether_frame_t*)packet_data(packet), packet->total_size);
+    switch (packet->l3_proto) {
         case NET_PROTOCOL_ARP: {
             err = packet_remove_header(packet, sizeof(ether_hdr_t));
             if (err < 0) {
@@ -126,6 +145,7 @@ net_err_t ether_init(void) {
             .close = ether_close,
             .in = ether_in,
             .out = ether_out,
+            .parse = ether_parse,
     };
 
     log_info(LOG_ETHER, "init ether");
@@ -180,6 +200,7 @@ net_err_t ether_raw_out(netif_t* netif, uint16_t protocol, const uint8_t* dest,
     // if destination address is ourselves, put it in our input queue
     // instead of sending it out to the network, just like loop back
     if (plat_memcmp(netif->hwaddr.addr, dest, ETH_HWA_SIZE) == 0) {
+        packet->csum = PACKET_CSUM_UNNECESSARY;
         return netif_put_in(netif, packet, -1);
     } else {
         err = netif_put_out(netif, packet, -1);
@@ -10,6 +10,8 @@ net_err_t loop_init(void);
  */
 static net_err_t loop_open(netif_t* netif, void* ops_data) {
     netif->type = NETIF_TYPE_LOOP;
+    // the packets never leave the host, no need to checksum them
+    netif->features = NETIF_F_TX_CSUM;
     return NET_OK;
 }
 
@@ -22,6 +24,7 @@ static net_err_t loop_transmit (struct _netif_t* netif) {
     // and put it into the output queue of loop interface
     packet_t * pktbuf = netif_get_out(netif, -1);
     if (pktbuf) {
+        pktbuf->csum = PACKET_CSUM_UNNECESSARY;
         net_err_t err = netif_put_in(netif, pktbuf, -1);
         if (err < 0) {
             log_warning(LOG_NETIF, "netif full");
@@ -102,6 +102,7 @@ netif_t* netif_open(const char* dev_name, const netif_ops_t* ops, void * ops_dat
     ipaddr_set_any(&netif->netmask);
     ipaddr_set_any(&netif->gateway);
     netif->mtu = 0;
+    netif->features = 0;
     netif->type = NETIF_TYPE_NONE;
     list_node_init(&netif->node);
 
@@ -283,11 +284,50 @@ net_err_t netif_put_in(netif_t* netif, packet_t * packet, int tmo) {
     return NET_OK;
 }
 
+/**
+ * Parse the headers of a received packet once, before it goes up the stack.
+ * The headers are made continuous, their lengths, the protocols and the flow hash are kept in the packet,
+ * so the layers don't parse them again.
+ */
+net_err_t netif_parse(netif_t* netif, packet_t * buf) {
+    buf->hdr_flags = 0;
+    buf->l2_len = 0;
+    if (netif->link_layer) {
+        if (netif->link_layer->parse) {
+            net_err_t err = netif->link_layer->parse(netif, buf);
+            if (err < 0) {
+                return err;
+            }
+        }
+    } else {
+        // without link layer, it is the loop back, which carries ip packets
+        buf->l3_proto = NET_PROTOCOL_IPv4;
+        buf->hdr_flags |= PACKET_HDR_L2;
+    }
+
+    if ((buf->hdr_flags & PACKET_HDR_L2) && (buf->l3_proto == NET_PROTOCOL_IPv4)) {
+        return ipv4_parse(buf, buf->l2_len);
+    }
+    return NET_OK;
+}
+
 /**
  * put a packet into the output queue of the network interface
  */
 net_err_t netif_put_out(netif_t* netif, packet_t * buf, int tmo) {
-    net_err_t err = fixed_queue_send(&netif->out_q, buf, tmo);
+    // the driver can't complete the checksum, do it here
+    if ((buf->csum == PACKET_CSUM_PARTIAL) && !(netif->features & NETIF_F_TX_CSUM)) {
+        net_err_t err = packet_csum_finish(buf);
+        if (err < 0) {
+            return err;
+        }
+    }
+    // a packet reusing a received frame must give the driver its buffer back before waiting in the queue
+    net_err_t err = packet_detach(buf);
+    if (err < 0) {
+        return err;
+    }
+    err = fixed_queue_send(&netif->out_q, buf, tmo);
     if (err < 0) {
         log_warning(LOG_NETIF, "netif %s out_q full", netif->name);
         return err;
@@ -18,12 +18,14 @@
 #include "sys_plat.h"
 #include "timer.h"
 #include "ipv4.h"
+#include "net_config.h"
 
 static void * msg_tbl[HANDLER_BUFFER_SIZE];  // For the message queue
+static mem_arena_t msg_tbl_arena;          // the queue, if more messages are configured
 static fixed_queue_t msg_queue;            // message queue
 //Be careful: size of exmsg_t must be the greater than list_node_t
 static exmsg_t msg_buffer[HANDLER_BUFFER_SIZE];  // For the memory pool
-static memory_pool_t msg_mem_pool;          // memory pool
+static lf_pool_t msg_mem_pool;              // memory pool, shared by the api, driver and worker threads
 
 
 /**
@@ -44,7 +46,7 @@ net_err_t exmsg_func_exec(exmsg_func_t func, void * param) {
         return NET_ERR_MEM;
     }
 
-    exmsg_t* msg = (exmsg_t*)memory_pool_alloc(&msg_mem_pool, 0);
+    exmsg_t* msg = (exmsg_t*)lf_pool_alloc(&msg_mem_pool, 0);
     msg->type = NET_EXMSG_FUN;
     msg->func_msg = &func_msg;
 
@@ -52,7 +54,7 @@ net_err_t exmsg_func_exec(exmsg_func_t func, void * param) {
     net_err_t err = fixed_queue_send(&msg_queue, msg, 0);
     if (err < 0) {
         log_error(LOG_HANDLER, "send msg to queue ailed. err = %d", err);
-        memory_pool_free(&msg_mem_pool, msg);
+        lf_pool_free(&msg_mem_pool, msg);
         sys_sem_free(func_msg.wait_sem);
         return err;
     }
@@ -81,13 +83,31 @@ static net_err_t do_func(func_msg_t* func_msg) {
  */
 net_err_t init_msg_handler (void) {
     log_info(LOG_HANDLER, "message handler init");
-    net_err_t err = fixed_queue_init(&msg_queue, msg_tbl, HANDLER_BUFFER_SIZE, HANDLER_LOCK_TYPE);
+    // the queue holds every message, its size is fixed, the messages are added as they are needed
+    int cnt = net_config()->msg_cnt;
+    void ** tbl = msg_tbl;
+    if (cnt > HANDLER_BUFFER_SIZE) {
+        size_t size = cnt * sizeof(void *);
+        if ((mem_arena_init(&msg_tbl_arena, size, 0) < 0) || (mem_arena_back(&msg_tbl_arena, size) < 0)) {
+            log_warning(LOG_HANDLER, "no arena for %d messages, %d only", cnt, HANDLER_BUFFER_SIZE);
+            mem_arena_destroy(&msg_tbl_arena);
+            cnt = HANDLER_BUFFER_SIZE;
+        } else {
+            tbl = (void **)msg_tbl_arena.base;
+        }
+    }
+    net_err_t err = fixed_queue_init(&msg_queue, tbl, cnt, HANDLER_LOCK_TYPE);
     if (err < 0) {
         log_error(LOG_HANDLER, "fixed queue init error");
         return err;
     }
 
-    err = memory_pool_init(&msg_mem_pool, msg_buffer, sizeof(exmsg_t), HANDLER_BUFFER_SIZE, HANDLER_LOCK_TYPE);
+    int blocking = HANDLER_LOCK_TYPE != LOCKER_NONE;
+    if (cnt > HANDLER_BUFFER_SIZE) {
+        err = lf_pool_init_grow(&msg_mem_pool, sizeof(exmsg_t), HANDLER_BUFFER_SIZE, cnt, blocking, 0, 0, 0);
+    } else {
+        err = lf_pool_init(&msg_mem_pool, msg_buffer, sizeof(exmsg_t), cnt, blocking);
+    }
     if (err < 0) {
         log_error(LOG_HANDLER,  "memory pool init error");
         return err;
@@ -103,7 +123,12 @@ static net_err_t do_netif_in(exmsg_t* msg) {
     while ((packet = netif_get_in(netif, -1))) {
         log_info(LOG_HANDLER, "recv a packet");
 
-        net_err_t err;
+        net_err_t err = netif_parse(netif, packet);
+        if (err < 0) {
+            packet_free(packet);
+            log_warning(LOG_HANDLER, "bad packet headers. err=%d", err);
+            continue;
+        }
         if (netif->link_layer) {
             err = netif->link_layer->in(netif, packet);
             if (err < 0) {
@@ -146,7 +171,7 @@ static void work_thread (void * arg) {
                     do_func(msg->func_msg);
                     break;
             }
-            memory_pool_free(&msg_mem_pool, msg);
+            lf_pool_free(&msg_mem_pool, msg);
         }
         int diff_ms = sys_time_goes(&time);
         time_last -= diff_ms;
@@ -176,7 +201,7 @@ net_err_t start_msg_handler (void) {
  * The main purpose is to notify the message handler thread to process packets in the msg_queue
  */
 net_err_t handler_netif_in(netif_t* netif) {
-    exmsg_t* msg = memory_pool_alloc(&msg_mem_pool, -1);
+    exmsg_t* msg = lf_pool_alloc(&msg_mem_pool, -1);
     if (!msg) {
         log_warning(LOG_HANDLER, "no free block");
         return NET_ERR_MEM;
@@ -186,7 +211,7 @@ net_err_t handler_netif_in(netif_t* netif) {
     net_err_t err = fixed_queue_send(&msg_queue, msg, -1);
     if (err < 0) {
         log_warning(LOG_HANDLER, "fixed queue full");
-        memory_pool_free(&msg_mem_pool, msg);
+        lf_pool_free(&msg_mem_pool, msg);
         return err;
     }
     return NET_OK;
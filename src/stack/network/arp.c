@@ -4,6 +4,7 @@
 #include "protocols.h"
 #include "utils.h"
 #include "timer.h"
+#include "net_config.h"
 
 static arp_entry_t cache_tbl[ARP_CACHE_SIZE];
 static memory_pool_t arp_cache_pool;
@@ -208,7 +209,8 @@ static net_err_t cache_insert(netif_t* netif, uint8_t* pro_addr, uint8_t* hw_add
 static net_err_t cache_init(void) {
     init_list(&cache_list);
     plat_memset(cache_tbl, 0, sizeof(cache_tbl));
-    net_err_t err = memory_pool_init(&arp_cache_pool, cache_tbl, sizeof(arp_entry_t), ARP_CACHE_SIZE, LOCKER_NONE);
+    net_err_t err = memory_pool_init_grow(&arp_cache_pool, cache_tbl, sizeof(arp_entry_t), ARP_CACHE_SIZE,
+                                          net_config()->arp_cache_cnt, LOCKER_NONE, 0);
     if (err < 0) {
         return err;
     }
@@ -292,7 +294,7 @@ net_err_t arp_init(void) {
  * Send ARP request to get the MAC address of the target IP address
  */
 net_err_t arp_make_request(netif_t* netif, const ipaddr_t* pro_addr) {
-    packet_t* packet = packet_alloc(sizeof(arp_pkt_t));
+    packet_t* packet = packet_alloc_headroom(sizeof(arp_pkt_t), NETIF_HEADROOM);
     if (packet == NULL) {
         dbg_dump_ip(LOG_ARP, "allocate arp packet failed. ip:", pro_addr);
         return NET_ERR_NONE;
@@ -443,6 +445,11 @@ net_err_t arp_resolve(netif_t* netif, const ipaddr_t* ipaddr, packet_t* packet)
         // if the entry is pending, then insert the packet into the waiting list
         // when the ARP reply comes back, worker thread will send the packets out in cache_insert()
         if (list_count(&entry->buf_list) <= ARP_MAX_PKT_WAIT) {
+            // the packet waits for the reply, don't keep the driver's buffer
+            net_err_t err = packet_detach(packet);
+            if (err < 0) {
+                return err;
+            }
             log_info(LOG_ARP, "insert packet to arp entry");
             list_insert_first(&entry->buf_list, &packet->node);
             return NET_OK;
@@ -453,6 +460,12 @@ net_err_t arp_resolve(netif_t* netif, const ipaddr_t* ipaddr, packet_t* packet)
     }  else {
         dbg_dump_ip(LOG_ARP, "make arp request, ip:", ipaddr);
 
+        // the packet waits for the reply, don't keep the driver's buffer
+        net_err_t err = packet_detach(packet);
+        if (err < 0) {
+            return err;
+        }
+
         // if there is no ARP entry for the IP address
         entry = cache_alloc(1);
         if (entry == (arp_entry_t*)0) {
@@ -27,11 +27,19 @@ static net_err_t icmpv4_out(ipaddr_t* dest, ipaddr_t* src, packet_t* packet) {
 
 
 static net_err_t icmpv4_echo_reply(ipaddr_t *dest, ipaddr_t * src, packet_t *packet) {
+    // the reply reuses the request, which must not keep the driver's buffer on its way out
+    net_err_t err = packet_detach(packet);
+    if (err < 0) {
+        return err;
+    }
     icmpv4_pkt_t* pkt = (icmpv4_pkt_t*)packet_data(packet);
-    // just modify the type and checksum field, the other remains the same
+    // just modify the type, the checksum of the request was verified, so update it for the changed word
+    uint16_t * type_code = (uint16_t *)&pkt->hdr;
+    uint16_t old_word = *type_code;
     pkt->hdr.type = ICMPv4_ECHO_REPLY;
-    pkt->hdr.checksum = 0;
-    return icmpv4_out(dest, src, packet);
+    pkt->hdr.checksum = checksum16_update(pkt->hdr.checksum, old_word, *type_code);
+    display_icmp_packet("icmp reply", pkt);
+    return ipv4_out(NET_PROTOCOL_ICMPv4, dest, src, packet);
 }
 
 
@@ -45,7 +53,7 @@ net_err_t icmpv4_out_unreach(ipaddr_t* dest, ipaddr_t * src, uint8_t code, packe
     }
 
     // allocate a packet buffer for the icmp packet
-    packet_t * new_buf = packet_alloc(copy_size + sizeof(icmpv4_hdr_t) + 4);
+    packet_t * new_buf = packet_alloc_headroom(copy_size + sizeof(icmpv4_hdr_t) + 4, IPV4_HEADROOM);
     if (new_buf == (packet_t*)0) {
         log_warning(LOG_ICMP, "alloc buf failed");
         return NET_ERR_NONE;
@@ -101,14 +109,13 @@ static net_err_t validate_icmp(icmpv4_pkt_t * pkt, int size, packet_t * packet)
  */
 net_err_t icmpv4_in(ipaddr_t *src, ipaddr_t * netif_ip, packet_t *packet) {
     log_info(LOG_ICMP, "icmp in !\n");
-    ipv4_pkt_t* ip_pkt = (ipv4_pkt_t*)packet_data(packet);
-    int iphdr_size = ip_pkt->hdr.shdr * 4;
-    net_err_t err = packet_set_cont(packet, sizeof(icmpv4_hdr_t) + iphdr_size);
-    if (err < 0) {
+    int iphdr_size = packet->l3_len;
+    net_err_t err;
+    // the header is continuous if it was parsed at ingress
+    if (!(packet->hdr_flags & PACKET_HDR_L4) && ((err = packet_set_cont(packet, sizeof(icmpv4_hdr_t) + iphdr_size)) < 0)) {
         log_error(LOG_ICMP, "set icmp cont failed");
         return err;
     }
-    ip_pkt = (ipv4_pkt_t*)packet_data(packet);
     packet_reset_pos(packet);
     packet_seek(packet, iphdr_size);    // skip ip header to get icmp header
     icmpv4_pkt_t * icmp_pkt = (icmpv4_pkt_t*)(packet_data(packet) + iphdr_size);
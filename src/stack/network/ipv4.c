@@ -377,10 +377,91 @@ static void iphdr_htons(ipv4_pkt_t* pkt) {
     pkt->hdr.frag_all = e_htons(pkt->hdr.frag_all);
 }
 
+/**
+ * Parse the ip header at offset of the packet, and the transport header after it,
+ * unless the packet is a fragment. Malformed ip headers are errors, the packet is dropped.
+ * */
+net_err_t ipv4_parse(packet_t * buf, int offset) {
+    net_err_t err = packet_set_cont(buf, offset + (int)sizeof(ipv4_hdr_t));
+    if (err < 0) {
+        log_warning(LOG_IP, "ip packet too small: %d", buf->total_size);
+        return err;
+    }
+    ipv4_pkt_t * pkt = (ipv4_pkt_t *)(packet_data(buf) + offset);
+    int hdr_len = ipv4_hdr_size(pkt);
+    if ((pkt->hdr.version != NET_VERSION_IPV4) || (hdr_len < (int)sizeof(ipv4_hdr_t))) {
+        log_warning(LOG_IP, "bad ip header: version %d, size %d", pkt->hdr.version, hdr_len);
+        return NET_ERR_NOT_SUPPORT;
+    }
+    if ((err = packet_set_cont(buf, offset + hdr_len)) < 0) {
+        log_warning(LOG_IP, "ip header size error: %d", hdr_len);
+        return err;
+    }
+    pkt = (ipv4_pkt_t *)(packet_data(buf) + offset);
+
+    buf->l3_len = hdr_len;
+    buf->l4_proto = pkt->hdr.protocol;
+    buf->hdr_flags |= PACKET_HDR_L3 | ((hdr_len > (int)sizeof(ipv4_hdr_t)) ? PACKET_HDR_IP_OPTS : 0);
+    // more fragments or offset, the header is still in network order
+    if (e_ntohs(pkt->hdr.frag_all) & 0x3FFF) {
+        buf->hdr_flags |= PACKET_HDR_FRAG;
+        return NET_OK;
+    }
+    ipv4_parse_l4(buf, offset);
+    return NET_OK;
+}
+
+/**
+ * parse the transport header after the ip header at offset.
+ * a truncated header is left to the transport layer to report
+ * */
+void ipv4_parse_l4(packet_t * buf, int offset) {
+    int l4_off = offset + buf->l3_len;
+    int l4_len;
+    switch (buf->l4_proto) {
+        case NET_PROTOCOL_TCP:
+            l4_len = sizeof(tcp_hdr_t);
+            break;
+        case NET_PROTOCOL_UDP:
+            l4_len = sizeof(udp_hdr_t);
+            break;
+        case NET_PROTOCOL_ICMPv4:
+            l4_len = sizeof(icmpv4_hdr_t);
+            break;
+        default:
+            return;
+    }
+    if (packet_set_cont(buf, l4_off + l4_len) < 0) {
+        return;
+    }
+    if (buf->l4_proto == NET_PROTOCOL_TCP) {
+        // with options
+        l4_len = tcp_hdr_size((tcp_hdr_t *)(packet_data(buf) + l4_off));
+        if ((l4_len < (int)sizeof(tcp_hdr_t)) || (packet_set_cont(buf, l4_off + l4_len) < 0)) {
+            return;
+        }
+    }
+
+    uint8_t * l4 = packet_data(buf) + l4_off;
+    ipv4_pkt_t * pkt = (ipv4_pkt_t *)(packet_data(buf) + offset);
+    ipaddr_t src, dest;
+    ipaddr_from_buf(&src, pkt->hdr.src_ip);
+    ipaddr_from_buf(&dest, pkt->hdr.dest_ip);
+    uint16_t sport = 0, dport = 0;
+    if (buf->l4_proto != NET_PROTOCOL_ICMPv4) {
+        // tcp and udp both start with the ports
+        sport = (uint16_t)((l4[0] << 8) | l4[1]);
+        dport = (uint16_t)((l4[2] << 8) | l4[3]);
+    }
+    buf->l4_len = l4_len;
+    buf->flow_hash = sock_flow_hash(&dest, dport, &src, sport);
+    buf->hdr_flags |= PACKET_HDR_L4;
+}
+
 /**
  * validate size and checksum of ipv4 packet
  * */
-static net_err_t validate_ipv4_pkt(ipv4_pkt_t* pkt, int size) {
+static net_err_t validate_ipv4_pkt(ipv4_pkt_t* pkt, int size, packet_csum_t csum) {
     if (pkt->hdr.version != NET_VERSION_IPV4) {
         log_warning(LOG_IP, "invalid ip version, only support ipv4!\n");
         return NET_ERR_NOT_SUPPORT;
@@ -396,7 +477,7 @@ static net_err_t validate_ipv4_pkt(ipv4_pkt_t* pkt, int size) {
         log_warning(LOG_IP, "ip packet size error: %d!\n", total_size);
         return NET_ERR_SIZE;
     }
-    if (pkt->hdr.hdr_checksum) {
+    if (pkt->hdr.hdr_checksum && (csum != PACKET_CSUM_UNNECESSARY)) {
         uint16_t c = checksum16(0,(uint16_t*)pkt, hdr_len, 0, 1);
         if (c != 0) {
             log_warning(LOG_IP, "Bad checksum: %0x(correct is: %0x)\n", pkt->hdr.hdr_checksum, c);
@@ -435,7 +516,7 @@ static net_err_t ip_normal_in(netif_t* netif, packet_t* packet, ipaddr_t* src, i
             return NET_OK;
         }
         case NET_PROTOCOL_TCP:{
-            packet_remove_header(packet, ipv4_hdr_size(pkt));
+            packet_remove_header(packet, packet->l3_len);
             net_err_t err = tcp_in(packet, src, dest);
             if (err < 0) {
                 log_warning(LOG_IP, "udp in error. err = %d\n", err);
@@ -457,13 +538,18 @@ static net_err_t ip_normal_in(netif_t* netif, packet_t* packet, ipaddr_t* src, i
 
 
 static net_err_t ip_frag_in (netif_t * netif, packet_t * buf, ipaddr_t* src, ipaddr_t* dest) {
+    // fragments wait for the others, copy them out of the driver's buffer
+    net_err_t err = packet_detach(buf);
+    if (err < 0) {
+        return err;
+    }
     ipv4_pkt_t * curr = (ipv4_pkt_t *)packet_data(buf);
     ip_frag_t * frag = frag_find(src, curr->hdr.id);
     if (!frag) {
         frag = frag_alloc();
         frag_add(frag, src, curr->hdr.id);
     }
-        net_err_t err = frag_insert(frag, buf, curr);
+        err = frag_insert(frag, buf, curr);
         if (err < 0) {
             log_warning(LOG_IP, "frag insert failed.");
             return err;
@@ -477,6 +563,8 @@ static net_err_t ip_frag_in (netif_t * netif, packet_t * buf, ipaddr_t* src, ipa
             display_ip_frags();
             return NET_OK;
         }
+        // the first fragment carries the ip header, now the transport header is complete
+        ipv4_parse_l4(full_buf, 0);
         err = ip_normal_in(netif, full_buf, src, dest);
         if (err < 0) {
             log_warning(LOG_IP,"ip frag in error. err=%d\n", err);
@@ -492,14 +580,15 @@ static net_err_t ip_frag_in (netif_t * netif, packet_t * buf, ipaddr_t* src, ipa
 
 net_err_t ipv4_in(netif_t* netif, packet_t* buf) {
     log_info(LOG_IP, "IP in\n");
-    net_err_t err = packet_set_cont(buf, sizeof(ipv4_hdr_t));
-    if (err < 0) {
+    // normally parsed at ingress by netif_parse
+    net_err_t err = NET_OK;
+    if (!(buf->hdr_flags & PACKET_HDR_L3) && ((err = ipv4_parse(buf, 0)) < 0)) {
         log_error(LOG_IP, "adjust header failed. err=%d\n", err);
         return err;
     }
 
     ipv4_pkt_t* pkt = (ipv4_pkt_t*)packet_data(buf);
-    if (validate_ipv4_pkt(pkt, buf->total_size) != NET_OK) {
+    if ((err = validate_ipv4_pkt(pkt, buf->total_size, buf->csum)) != NET_OK) {
         log_warning(LOG_IP, "packet is broken. drop it.\n");
         return err;
     }
@@ -510,6 +599,10 @@ net_err_t ipv4_in(netif_t* netif, packet_t* buf) {
     // and there might be padding zeros at tail, resize the packet to total size
     // total_size = ip-header + payload
     // ethernet-header + [ip-header + payload + padding zeros] + fcs
+    // the sum of the driver may include the padding, verify the normal way then
+    if ((buf->csum == PACKET_CSUM_COMPLETE) && (buf->total_size != pkt->hdr.total_len)) {
+        buf->csum = PACKET_CSUM_NONE;
+    }
     err = packet_resize(buf, pkt->hdr.total_len);
     if (err < 0) {
         log_error(LOG_IP, "ip packet resize failed. err=%d\n", err);
@@ -526,6 +619,10 @@ net_err_t ipv4_in(netif_t* netif, packet_t* buf) {
         return NET_ERR_UNREACH;
     }
     if (pkt->hdr.offset || pkt->hdr.more) {
+        // a sum of the driver only covers this fragment
+        if (buf->csum == PACKET_CSUM_COMPLETE) {
+            buf->csum = PACKET_CSUM_NONE;
+        }
         err = ip_frag_in(netif, buf, &src_ip, &dest_ip);
     } else {
         err = ip_normal_in(netif, buf, &src_ip, &dest_ip);
@@ -543,6 +640,8 @@ static net_err_t ip_frag_out(uint8_t protocol, ipaddr_t* dest,
     packet_reset_pos(buf);
     int offset = 0;
     int total = buf->total_size;        // this does not include the header
+    // the headers of the fragments only differ in length and offset, the checksum is updated for them
+    uint16_t prev_checksum = 0, prev_len = 0, prev_frag = 0;
     while (total) {
         int curr_size = total;
         if (curr_size > netif->mtu - sizeof(ipv4_hdr_t)) {
@@ -556,11 +655,20 @@ static net_err_t ip_frag_out(uint8_t protocol, ipaddr_t* dest,
             curr_size &= ~0x7;
         }
 
-        packet_t * dest_buf = packet_alloc(curr_size + sizeof(ipv4_hdr_t));
+        // the fragment shares the payload pages of buf, only its header is new,
+        // the position follows the fragments so the clone finds its first page next to it
+        packet_seek(buf, offset);
+        packet_t * dest_buf = packet_clone(buf, offset, curr_size);
         if (!dest_buf) {
             log_error(LOG_IP,"alloc buf for frag send failed.\n");
             return NET_ERR_MEM;
         }
+        net_err_t err = packet_add_header(dest_buf, sizeof(ipv4_hdr_t), 1);
+        if (err < 0) {
+            log_error(LOG_IP,"add header for frag failed. error = %d.\n", err);
+            packet_free(dest_buf);
+            return err;
+        }
         ipv4_pkt_t * pkt = (ipv4_pkt_t *)packet_data(dest_buf);
         pkt->hdr.shdr_all = 0;
         pkt->hdr.version = NET_VERSION_IPV4;
@@ -580,20 +688,18 @@ static net_err_t ip_frag_out(uint8_t protocol, ipaddr_t* dest,
         pkt->hdr.offset = offset >> 3;      // the unit is 8 bytes
         pkt->hdr.more = total > curr_size;
 
-        // copy data from buf to dest_buf
-        packet_seek(dest_buf, sizeof(ipv4_hdr_t));
-        net_err_t err = packet_copy(dest_buf, buf, curr_size);
-        if (err < 0) {
-            log_error(LOG_IP,"frag copy failed. error = %d.\n", err);
-            packet_free(dest_buf);
-            return err;
-        }
-        packet_remove_header(buf, curr_size);
-        packet_reset_pos(buf);
         iphdr_htons(pkt);
-        // before calculate the checksum, reset the pos
-        packet_seek(dest_buf, 0);
-        pkt->hdr.hdr_checksum = packet_checksum16(dest_buf, ipv4_hdr_size(pkt), 0, 1);
+        // the header is continuous, sum it in place
+        packet_reset_pos(dest_buf);
+        if (offset == 0) {
+            pkt->hdr.hdr_checksum = checksum16(0, pkt, sizeof(ipv4_hdr_t), 0, 1);
+        } else {
+            uint16_t checksum = checksum16_update(prev_checksum, prev_len, pkt->hdr.total_len);
+            pkt->hdr.hdr_checksum = checksum16_update(checksum, prev_frag, pkt->hdr.frag_all);
+        }
+        prev_checksum = pkt->hdr.hdr_checksum;
+        prev_len = pkt->hdr.total_len;
+        prev_frag = pkt->hdr.frag_all;
         display_ip_packet((ipv4_pkt_t*)pkt);
         err = netif_out(netif, next, dest_buf);
         if (err < 0) {
@@ -620,6 +726,13 @@ net_err_t ipv4_out(uint8_t protocol, ipaddr_t* dest, ipaddr_t * src, packet_t* p
         log_error(LOG_IP,"send failed. no route.");
         return NET_ERR_UNREACH;
     }
+    return ipv4_out_rt(protocol, dest, src, packet, rt);
+}
+
+/**
+ * send with a route already looked up, so that a batch of packets to the same dest can share it
+ */
+net_err_t ipv4_out_rt(uint8_t protocol, ipaddr_t* dest, ipaddr_t * src, packet_t* packet, rentry_t * rt) {
     ipaddr_t next_hop;
     if (ipaddr_is_any(&rt->next_hop)) {
         // if the dest is in the LAN, that means we only need one direct hop, make the next hop the dest itself
@@ -630,7 +743,12 @@ net_err_t ipv4_out(uint8_t protocol, ipaddr_t* dest, ipaddr_t * src, packet_t* p
     }
     //netif_t * netif = netif_get_default();
     if (rt->netif->mtu && ((packet->total_size + sizeof(ipv4_hdr_t)) > rt->netif->mtu)) {
-        net_err_t err = ip_frag_out(protocol, dest, src, packet, &next_hop, rt->netif);
+        // the fragments share the data, the checksum has to be in it before splitting
+        net_err_t err = packet_csum_finish(packet);
+        if (err < 0) {
+            return err;
+        }
+        err = ip_frag_out(protocol, dest, src, packet, &next_hop, rt->netif);
         if (err < 0) {
             log_warning(LOG_IP, "send ip frag packet failed. error = %d\n", err);
             return err;
@@ -662,7 +780,8 @@ net_err_t ipv4_out(uint8_t protocol, ipaddr_t* dest, ipaddr_t * src, packet_t* p
     // convert the fields in header to network byte order
     iphdr_htons(ip_datagram);
     packet_reset_pos(packet);
-    ip_datagram->hdr.hdr_checksum = packet_checksum16(packet, ipv4_hdr_size(ip_datagram), 0, 1);
+    // the header was made continuous, no need to walk the pages
+    ip_datagram->hdr.hdr_checksum = checksum16(0, ip_datagram, sizeof(ipv4_hdr_t), 0, 1);
     err = netif_out(rt->netif, &next_hop, packet);
     if (err < 0) {
         log_warning(LOG_IP, "send ip packet failed. error = %d\n", err);
@@ -13,8 +13,15 @@
 
 /**
  * initialization of the protocol stack
+ * cfg sizes the pools, 0 for the sizes in easy_net_config.h
  */
-net_err_t init_stack(void) {
+net_err_t init_stack(const net_config_t * cfg) {
+    if (cfg) {
+        net_err_t err = net_config_set(cfg);
+        if (err < 0) {
+            return err;
+        }
+    }
     net_plat_init();
     net_timer_init();
     utils_init();
@@ -8,6 +8,7 @@
 #include "tcp_out.h"
 #include "tcp_state.h"
 #include "tcp_in.h"
+#include "net_config.h"
 
 
 static tcp_t tcp_tbl[TCP_MAX_NR];
@@ -168,6 +169,123 @@ net_err_t tcp_setopt(struct _sock_t* sock,  int level, int optname, const char *
     return NET_ERR_PARAM;
 }
 
+/**
+ * take a snapshot of the connection for TCP_INFO
+ */
+static void tcp_fill_info (tcp_t * tcp, struct x_tcp_info * info) {
+    plat_memset(info, 0, sizeof(struct x_tcp_info));
+    info->state = tcp->state;
+    ipaddr_to_buf(&tcp->base.local_ip, (uint8_t *)&info->local_addr);
+    ipaddr_to_buf(&tcp->base.remote_ip, (uint8_t *)&info->remote_addr);
+    info->local_port = tcp->base.local_port;
+    info->remote_port = tcp->base.remote_port;
+
+    info->rto = tcp->snd.rto;
+    info->srtt = tcp->snd.srtt;
+    info->rttvar = tcp->snd.rttvar;
+    info->snd_cwnd = 0;             // no congestion control yet
+    info->snd_ssthresh = 0;
+    info->snd_wnd = tcp->snd.wnd;
+    info->rcv_wnd = tcp_rcv_window(tcp);
+    info->mss = tcp->mss;
+
+    info->bytes_acked = tcp->stats.bytes_acked;
+    info->bytes_received = tcp->stats.bytes_received;
+    info->unacked = (int)(tcp->snd.nxt - tcp->snd.una);
+    info->retransmits = tcp->snd.rexmit_cnt;
+    info->total_retrans = tcp->stats.total_retrans;
+    info->dup_acks = tcp->stats.dup_acks;
+    info->ooo_drops = tcp->stats.ooo_drops;
+
+    info->snd_buf_used = tcp_snd_cnt(tcp);
+    info->snd_buf_size = tcp_buf_size(&tcp->snd.buf);
+    info->rcv_buf_used = tcp_buf_cnt(&tcp->rcv.buf);
+    info->rcv_buf_size = tcp_buf_size(&tcp->rcv.buf);
+}
+
+
+net_err_t tcp_getopt(struct _sock_t* sock,  int level, int optname, char * optval, int * optlen) {
+    // more general options are handled by sock_getopt
+    net_err_t err = sock_getopt(sock, level, optname, optval, optlen);
+    if (err == NET_OK) {
+        return NET_OK;
+    } else if ((err < 0) && (err != NET_ERR_NOT_SUPPORT)) {
+        return err;
+    }
+    tcp_t * tcp = (tcp_t *)sock;
+    if ((level == SOL_TCP) && (optname == TCP_INFO)) {
+        if (*optlen < (int)sizeof(struct x_tcp_info)) {
+            log_error(LOG_TCP, "param size error");
+            return NET_ERR_PARAM;
+        }
+        tcp_fill_info(tcp, (struct x_tcp_info *)optval);
+        *optlen = sizeof(struct x_tcp_info);
+        return NET_OK;
+    } else if ((level == SOL_TCP) && (optname == TCP_ZEROCOPY_DONE)) {
+        if (*optlen < (int)sizeof(struct x_zc_done)) {
+            log_error(LOG_TCP, "param size error");
+            return NET_ERR_PARAM;
+        }
+        // report the sends completed since last time
+        tcp_zc_complete(tcp);
+        struct x_zc_done * done = (struct x_zc_done *)optval;
+        done->cnt = (int)(tcp->snd.zc.done_id - tcp->snd.zc.report_id);
+        done->lo = tcp->snd.zc.report_id;
+        done->hi = tcp->snd.zc.done_id - 1;
+        tcp->snd.zc.report_id = tcp->snd.zc.done_id;
+        *optlen = sizeof(struct x_zc_done);
+        return NET_OK;
+    }
+
+    int value;
+    if ((level == SOL_SOCKET) && (optname == SO_KEEPALIVE)) {
+        value = tcp->flags.keep_enable;
+    } else if (level == SOL_TCP) {
+        switch (optname) {
+            case TCP_KEEPIDLE:
+                value = tcp->conn.keep_idle;
+                break;
+            case TCP_KEEPINTVL:
+                value = tcp->conn.keep_intvl;
+                break;
+            case TCP_KEEPCNT:
+                value = tcp->conn.keep_cnt;
+                break;
+            default:
+                log_error(LOG_TCP, "unknown param");
+                return NET_ERR_PARAM;
+        }
+    } else {
+        log_error(LOG_TCP, "unknown param");
+        return NET_ERR_PARAM;
+    }
+
+    if (*optlen < (int)sizeof(int)) {
+        log_error(LOG_TCP, "param size error");
+        return NET_ERR_PARAM;
+    }
+    *(int *)optval = value;
+    *optlen = sizeof(int);
+    return NET_OK;
+}
+
+
+/**
+ * fill info with at most cnt connections in the tcp list, return the number filled
+ */
+int tcp_info_list (struct x_tcp_info * info, int cnt) {
+    int idx = 0;
+    list_node_t * node;
+    list_for_each(node, &tcp_list) {
+        if (idx >= cnt) {
+            break;
+        }
+        tcp_t * tcp = (tcp_t *)list_entry(node, sock_t, node);
+        tcp_fill_info(tcp, info + idx++);
+    }
+    return idx;
+}
+
 /**
  * bind a local port to listen
  */
@@ -211,6 +329,10 @@ net_err_t tcp_bind(sock_t* sock, const struct x_sockaddr* addr, x_socklen_t len)
             continue;
         }
 //        log_info(LOG_TCP, "port in use %d and try to bind port %d", curr->local_port, addr_in->sin_port);
+        // listeners can share the ip-port pair if all of them have SO_REUSEPORT set
+        if (curr->reuseport && sock->reuseport) {
+            continue;
+        }
         if (ipaddr_is_equal(&curr->local_ip, &local_ip) && (curr->local_port == e_ntohs(addr_in->sin_port))) {
             log_error(LOG_TCP, "ipaddr and port already used");
             return NET_ERR_ADDR;
@@ -230,6 +352,7 @@ static tcp_t* tcp_alloc(int wait, int family, int protocol) {
             .send = tcp_send,
             .recv = tcp_recv,
             .setopt = tcp_setopt,
+            .getopt = tcp_getopt,
             .bind = tcp_bind,
             .listen = tcp_listen,
             .accept = tcp_accept,
@@ -289,7 +412,7 @@ alloc_failed:
 
 void tcp_insert (tcp_t * tcp) {
     list_insert_last(&tcp_list, &tcp->base.node);
-    assert_halt(tcp_list.count <= TCP_MAX_NR, "tcp free");
+    assert_halt(tcp_list.count <= net_config()->tcp_cnt, "tcp free");
 }
 
 
@@ -305,8 +428,14 @@ sock_t* tcp_create (int family, int protocol) {
 
 net_err_t tcp_init(void) {
     log_info(LOG_TCP, "tcp init.");
-    memory_pool_init(&tcp_mblock, tcp_tbl, sizeof(tcp_t), TCP_MAX_NR, LOCKER_NONE);
+    memory_pool_init_grow(&tcp_mblock, tcp_tbl, sizeof(tcp_t), TCP_MAX_NR, net_config()->tcp_cnt, LOCKER_NONE,
+                          (net_config()->huge_pages & NET_HUGE_SOCKET) ? MEM_ARENA_HUGE : 0);
     init_list(&tcp_list);
+    net_err_t err = tcp_zc_init();
+    if (err < 0) {
+        log_error(LOG_TCP, "zero-copy init failed.");
+        return err;
+    }
     log_info(LOG_TCP, "init done.");
     return NET_OK;
 }
@@ -417,11 +546,29 @@ net_err_t tcp_connect(sock_t* sock, const struct x_sockaddr* addr, x_socklen_t l
 }
 
 
+#define TCP_MATCH_NONE          0
+#define TCP_MATCH_ANY           1           // listener on the wildcard ip
+#define TCP_MATCH_SPEC          2           // listener on the exact local ip
+
+static int tcp_listen_match(sock_t * s, ipaddr_t * local_ip, uint16_t local_port) {
+    tcp_t * tcp = (tcp_t *)s;
+    if ((tcp->state != TCP_STATE_LISTEN) || (s->local_port != local_port)) {
+        return TCP_MATCH_NONE;
+    }
+    if (ipaddr_is_equal(&s->local_ip, local_ip)) {
+        return TCP_MATCH_SPEC;
+    }
+    return ipaddr_is_any(&s->local_ip) ? TCP_MATCH_ANY : TCP_MATCH_NONE;
+}
+
+
 /**
  * if not perfectly matched, search for listen socket
+ * listeners sharing the port with SO_REUSEPORT are picked by the hash of the four-tuple,
+ * once the SYN has created the child socket, the flow is perfectly matched and stays there
  * */
-sock_t* tcp_find(ipaddr_t * local_ip, uint16_t local_port, ipaddr_t * remote_ip, uint16_t remote_port) {
-    sock_t* match = (sock_t*)0;
+sock_t* tcp_find(packet_t * buf, ipaddr_t * local_ip, uint16_t local_port, ipaddr_t * remote_ip, uint16_t remote_port) {
+    int spec_cnt = 0, any_cnt = 0;
     list_node_t* node;
     list_for_each(node, &tcp_list) {
         sock_t* s = list_entry(node, sock_t, node);
@@ -431,17 +578,37 @@ sock_t* tcp_find(ipaddr_t * local_ip, uint16_t local_port, ipaddr_t * remote_ip,
             ipaddr_is_equal(&s->remote_ip, remote_ip) && (s->remote_port == remote_port)) {
             return s;
         }
-        // for listen socket, if exactly matched, return it, else check for wildcard
-        tcp_t * tcp = (tcp_t *)s;
-        if ((tcp->state == TCP_STATE_LISTEN) && (s->local_port == local_port)) {
-            if (ipaddr_is_equal(&s->local_ip, local_ip)) {
-                return s;
-            } else if (ipaddr_is_any(&s->local_ip)) {
-                match = s;
-            }
+        // for listen socket, exactly matched is preferred over the wildcard
+        switch (tcp_listen_match(s, local_ip, local_port)) {
+            case TCP_MATCH_SPEC:
+                spec_cnt++;
+                break;
+            case TCP_MATCH_ANY:
+                any_cnt++;
+                break;
+            default:
+                break;
         }
     }
-    return (sock_t*)match;
+
+    int level = spec_cnt ? TCP_MATCH_SPEC : TCP_MATCH_ANY;
+    int cnt = spec_cnt ? spec_cnt : any_cnt;
+    if (cnt == 0) {
+        return (sock_t *)0;
+    }
+    int pick = 0;
+    if (cnt > 1) {
+        // the hash is taken when the headers are parsed at ingress
+        uint32_t hash = (buf->hdr_flags & PACKET_HDR_L4) ? buf->flow_hash : sock_flow_hash(local_ip, local_port, remote_ip, remote_port);
+        pick = (int)(hash % cnt);
+    }
+    list_for_each(node, &tcp_list) {
+        sock_t* s = list_entry(node, sock_t, node);
+        if ((tcp_listen_match(s, local_ip, local_port) == level) && (pick-- == 0)) {
+            return s;
+        }
+    }
+    return (sock_t*)0;
 }
 
 
@@ -461,6 +628,7 @@ net_err_t tcp_abort (tcp_t * tcp, int err) {
 
 void tcp_free(tcp_t* tcp) {
     assert_halt(tcp->state != TCP_STATE_FREE, "tcp free");
+    tcp_zc_free(tcp);
     sock_wait_destroy(&tcp->conn.wait);
     sock_wait_destroy(&tcp->snd.wait);
     sock_wait_destroy(&tcp->rcv.wait);
@@ -505,11 +673,9 @@ net_err_t tcp_close(sock_t* sock) {
 
 
 /**
- * only allowed in ESTABLISHED or CLOSE_WAIT state
+ * check if data can be sent in current state, only allowed in ESTABLISHED or CLOSE_WAIT state
  */
-net_err_t tcp_send (struct _sock_t* sock, const void* buf, size_t len, int flags, ssize_t * result_len) {
-    tcp_t* tcp = (tcp_t*)sock;
-
+static net_err_t tcp_send_check (tcp_t * tcp) {
     switch (tcp->state) {
         case TCP_STATE_CLOSED:
             log_error(LOG_TCP, "tcp closed: send is not allowed");
@@ -536,22 +702,15 @@ net_err_t tcp_send (struct _sock_t* sock, const void* buf, size_t len, int flags
             log_error(LOG_TCP, "tcp state error[%s]: send is not allowed", tcp_state_name(tcp->state));
             return NET_ERR_STATE;
     }
-    ssize_t size = tcp_write_sndbuf(tcp, (uint8_t *)buf, (int)len);
-    if (size <= 0) {
-        // when buffer is full, wait for data to be sent and acked
-        *result_len = 0;
-        return NET_ERR_NEED_WAIT;
-    } else {
-        *result_len = size;
-        tcp_out_event(tcp, TCP_OEVENT_SEND);
-        return NET_OK;
-    }
+    return NET_OK;
 }
 
 
-net_err_t tcp_recv (struct _sock_t* s, void* buf, size_t len, int flags, ssize_t * result_len) {
-    tcp_t* tcp = (tcp_t*)s;
-    net_err_t need_wait = NET_ERR_NEED_WAIT;
+/**
+ * check if data can be received in current state
+ * return NET_ERR_NEED_WAIT if it's ok to wait for more data, NET_OK if no more data will come
+ */
+static net_err_t tcp_recv_check (tcp_t * tcp) {
     switch (tcp->state) {
         case TCP_STATE_LAST_ACK:
         case TCP_STATE_CLOSED:
@@ -560,12 +719,11 @@ net_err_t tcp_recv (struct _sock_t* s, void* buf, size_t len, int flags, ssize_t
         case TCP_STATE_CLOSE_WAIT:
         case TCP_STATE_CLOSING:
             // the passive close, we can still call recv() but no need to wait
-            need_wait = NET_OK;
-            break;
+            return NET_OK;
         case TCP_STATE_FIN_WAIT_1:
         case TCP_STATE_FIN_WAIT_2:
         case TCP_STATE_ESTABLISHED:
-            break;
+            return NET_ERR_NEED_WAIT;
         case TCP_STATE_LISTEN:
         case TCP_STATE_SYN_SENT:
         case TCP_STATE_SYN_RECVD:
@@ -574,6 +732,40 @@ net_err_t tcp_recv (struct _sock_t* s, void* buf, size_t len, int flags, ssize_t
             log_error(LOG_TCP, "tcp state error");
             return NET_ERR_STATE;
     }
+}
+
+
+net_err_t tcp_send (struct _sock_t* sock, const void* buf, size_t len, int flags, ssize_t * result_len) {
+    tcp_t* tcp = (tcp_t*)sock;
+    net_err_t err = tcp_send_check(tcp);
+    if (err < 0) {
+        return err;
+    }
+    ssize_t size;
+    if (flags & MSG_ZEROCOPY) {
+        // the buffer is referenced by the outgoing segments until TCP_ZEROCOPY_DONE reports it
+        size = tcp_write_zc(tcp, (const uint8_t *)buf, (int)len);
+    } else {
+        size = tcp_write_sndbuf(tcp, (uint8_t *)buf, (int)len);
+    }
+    if (size <= 0) {
+        // when buffer is full, wait for data to be sent and acked
+        *result_len = 0;
+        return NET_ERR_NEED_WAIT;
+    } else {
+        *result_len = size;
+        tcp_out_event(tcp, TCP_OEVENT_SEND);
+        return NET_OK;
+    }
+}
+
+
+net_err_t tcp_recv (struct _sock_t* s, void* buf, size_t len, int flags, ssize_t * result_len) {
+    tcp_t* tcp = (tcp_t*)s;
+    net_err_t need_wait = tcp_recv_check(tcp);
+    if (need_wait < 0) {
+        return need_wait;
+    }
     *result_len = 0;
     int cnt = tcp_buf_read_rcv(&tcp->rcv.buf, buf, (int)len);
     if (cnt > 0) {
@@ -584,6 +776,42 @@ net_err_t tcp_recv (struct _sock_t* s, void* buf, size_t len, int flags, ssize_t
 }
 
 
+/**
+ * move data from the receive buffer of in to the send buffer of out, without user buffer in between
+ * if nothing can be moved, blocker is set to the side to wait for
+ */
+net_err_t tcp_splice (struct _sock_t * in, struct _sock_t * out, size_t len, ssize_t * result_len, struct _sock_t ** blocker) {
+    tcp_t * src = (tcp_t *)in;
+    tcp_t * dest = (tcp_t *)out;
+    *result_len = 0;
+
+    net_err_t need_wait = tcp_recv_check(src);
+    if (need_wait < 0) {
+        return need_wait;
+    }
+    net_err_t err = tcp_send_check(dest);
+    if (err < 0) {
+        return err;
+    }
+
+    if (tcp_buf_cnt(&src->rcv.buf) == 0) {
+        *blocker = in;
+        return need_wait;
+    }
+    // zero-copy sends must be acked before buffered data is queued, see tcp_write_sndbuf()
+    if (dest->snd.zc.cnt || (tcp_buf_free_cnt(&dest->snd.buf) == 0)) {
+        *blocker = out;
+        return NET_ERR_NEED_WAIT;
+    }
+
+    // both windows are respected: only data already received, only free space of the send buffer
+    int size = tcp_buf_move(&dest->snd.buf, &src->rcv.buf, (len > INT32_MAX) ? INT32_MAX : (int)len);
+    *result_len = size;
+    tcp_out_event(dest, TCP_OEVENT_SEND);
+    return NET_OK;
+}
+
+
 
 net_err_t tcp_listen (struct _sock_t* s, int backlog) {
     tcp_t * tcp = (tcp_t *)s;
@@ -690,4 +918,5 @@ void tcp_destroy (struct _sock_t * sock) {
 void tcp_kill_all_timers (tcp_t * tcp) {
     net_timer_remove(&tcp->conn.keep_timer);
     net_timer_remove(&tcp->snd.timer);
+    net_timer_remove(&tcp->snd.zc.timer);
 }
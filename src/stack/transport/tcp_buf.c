@@ -1,5 +1,6 @@
 #include "tcp_buf.h"
 #include "log.h"
+#include "sys_plat.h"
 
 void tcp_buf_init(tcp_buf_t* buf, uint8_t * data, int size) {
     buf->in = buf->out = 0;
@@ -9,47 +10,96 @@ void tcp_buf_init(tcp_buf_t* buf, uint8_t * data, int size) {
 }
 
 
-void tcp_buf_write_send(tcp_buf_t * dest, const uint8_t * buffer, int len) {
-    while (len > 0) {
-        dest->data[dest->in++] = *buffer++;
-        if (dest->in >= dest->size) {
-            dest->in = 0;
-        }
+/**
+ * split cnt bytes starting from pos into at most two spans, the second one starts from 0 when wrap around
+ * return the number of spans used
+ */
+static int tcp_buf_split(tcp_buf_t * buf, int pos, int cnt, tcp_buf_iov_t iov[2]) {
+    if (pos >= buf->size) {
+        pos -= buf->size;
+    }
+    int to_end = buf->size - pos;
+    iov[0].data = buf->data + pos;
+    iov[0].len = (cnt > to_end) ? to_end : cnt;
+    iov[1].data = buf->data;
+    iov[1].len = cnt - iov[0].len;
+    return iov[1].len ? 2 : (iov[0].len ? 1 : 0);
+}
+
+
+/**
+ * get the free space after in, so that producers can write into the ring directly
+ * return the total free size, use tcp_buf_commit_write() to add the written data to the buffer
+ */
+int tcp_buf_peek_free(tcp_buf_t * buf, tcp_buf_iov_t iov[2]) {
+    int free_cnt = tcp_buf_free_cnt(buf);
+    tcp_buf_split(buf, buf->in, free_cnt, iov);
+    return free_cnt;
+}
 
-        dest->count++;
-        len--;
+
+/**
+ * add cnt bytes written into the spans of tcp_buf_peek_free() to the buffer
+ */
+void tcp_buf_commit_write(tcp_buf_t * buf, int cnt) {
+    int free_cnt = tcp_buf_free_cnt(buf);
+    if (cnt > free_cnt) {
+        log_warning(LOG_TCP, "commit too much: %d > %d", cnt, free_cnt);
+        cnt = free_cnt;
     }
+    buf->in += cnt;
+    if (buf->in >= buf->size) {
+        buf->in -= buf->size;
+    }
+    buf->count += cnt;
+}
+
+
+/**
+ * get the data starting from offset after out, so that consumers can read from the ring directly
+ * return the total data size, use tcp_buf_commit_read() to release the data
+ */
+int tcp_buf_peek_data(tcp_buf_t * buf, int offset, tcp_buf_iov_t iov[2]) {
+    int cnt = buf->count - offset;
+    if (cnt < 0) {
+        cnt = 0;
+    }
+    tcp_buf_split(buf, buf->out + offset, cnt, iov);
+    return cnt;
+}
+
+
+void tcp_buf_write_send(tcp_buf_t * dest, const uint8_t * buffer, int len) {
+    tcp_buf_iov_t iov[2];
+    int free_cnt = tcp_buf_peek_free(dest, iov);
+    len = (len > free_cnt) ? free_cnt : len;
+
+    int curr_copy = (len > iov[0].len) ? iov[0].len : len;
+    plat_memcpy(iov[0].data, buffer, curr_copy);
+    if (len > curr_copy) {
+        plat_memcpy(iov[1].data, buffer + curr_copy, len - curr_copy);
+    }
+    tcp_buf_commit_write(dest, len);
 }
 
 
 /**
  * start from offset, read count bytes from buffer and write to dest packet
+ * if sum is not null, the checksum of the data is added to it while copying
  */
-void tcp_buf_read_send(tcp_buf_t * buf, int offset, packet_t * dest, int count) {
-    int free_for_us = buf->count - offset;
+void tcp_buf_read_send(tcp_buf_t * buf, int offset, packet_t * dest, int count, uint32_t * sum) {
+    tcp_buf_iov_t iov[2];
+    int free_for_us = tcp_buf_peek_data(buf, offset, iov);
     if (count > free_for_us) {
         log_warning(LOG_TCP, "resize for send: %d -> %d", count, free_for_us);
         count = free_for_us;
     }
 
     // be careful with wrap around
-    int start = buf->out + offset;
-    if (start >= buf->size) {
-        start -= buf->size;
-    }
-
-    while (count > 0) {
-        int end = start + count;
-        if (end >= buf->size) {
-            end = buf->size;
-        }
-        int copy_size = (int)(end - start);
-        net_err_t err = packet_write(dest, buf->data + start, (int)copy_size);
+    for (int i = 0; (i < 2) && (count > 0); i++) {
+        int copy_size = (count > iov[i].len) ? iov[i].len : count;
+        net_err_t err = packet_write_csum(dest, iov[i].data, copy_size, sum);
         assert_halt(err >= 0, "write buffer failed.");
-        start += copy_size;
-        if (start >= buf->size) {
-            start -= buf->size;
-        }
         count -= copy_size;
     }
 }
@@ -71,6 +121,42 @@ int tcp_buf_remove(tcp_buf_t * buf, int cnt) {
 }
 
 
+/**
+ * move at most cnt bytes from src to dest, span by span
+ * return the number of bytes moved, limited by the data in src and the free space in dest
+ */
+int tcp_buf_move(tcp_buf_t * dest, tcp_buf_t * src, int cnt) {
+    tcp_buf_iov_t from[2], to[2];
+    int total = tcp_buf_peek_data(src, 0, from);
+    int free_cnt = tcp_buf_peek_free(dest, to);
+    total = (total > free_cnt) ? free_cnt : total;
+    total = (total > cnt) ? cnt : total;
+
+    int i = 0, j = 0, from_off = 0, to_off = 0;
+    int remain = total;
+    while (remain > 0) {
+        int curr_copy = from[i].len - from_off;
+        curr_copy = (curr_copy > to[j].len - to_off) ? to[j].len - to_off : curr_copy;
+        curr_copy = (curr_copy > remain) ? remain : curr_copy;
+        plat_memcpy(to[j].data + to_off, from[i].data + from_off, curr_copy);
+        from_off += curr_copy;
+        to_off += curr_copy;
+        remain -= curr_copy;
+        if (from_off == from[i].len) {
+            i++;
+            from_off = 0;
+        }
+        if (to_off == to[j].len) {
+            j++;
+            to_off = 0;
+        }
+    }
+    tcp_buf_commit_write(dest, total);
+    tcp_buf_commit_read(src, total);
+    return total;
+}
+
+
 /**
  * extract data in packet, write to recv buffer
  */
@@ -102,15 +188,15 @@ int tcp_buf_write_rcv(tcp_buf_t * dest, int offset, packet_t * src, int total) {
 
 
 int tcp_buf_read_rcv (tcp_buf_t * src, uint8_t * buf, int size) {
-    int total = size > src->count ? src->count : size;
-    int curr_size = 0;
-    while (curr_size < total) {
-        *buf++ = src->data[src->out++];
-        if (src->out >= src->size) {
-            src->out = 0;
-        }
-        src->count--;
-        curr_size++;
+    tcp_buf_iov_t iov[2];
+    int total = tcp_buf_peek_data(src, 0, iov);
+    total = (size > total) ? total : size;
+
+    int curr_copy = (total > iov[0].len) ? iov[0].len : total;
+    plat_memcpy(buf, iov[0].data, curr_copy);
+    if (total > curr_copy) {
+        plat_memcpy(buf + curr_copy, iov[1].data, total - curr_copy);
     }
+    tcp_buf_commit_read(src, total);
     return total;
 }
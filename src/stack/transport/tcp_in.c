@@ -88,15 +88,15 @@ net_err_t tcp_in(packet_t *buf, ipaddr_t *src_ip, ipaddr_t *dest_ip) {
             [TCP_STATE_LISTEN] = tcp_listen_in,
             [TCP_STATE_SYN_RECVD] = tcp_syn_recvd_in,
     };
-    tcp_hdr_t * tcp_hdr = (tcp_hdr_t *)packet_data(buf);
-    if (packet_set_cont(buf, sizeof(tcp_hdr_t)) < 0) {
+    // the header is continuous if it was parsed at ingress
+    if (!(buf->hdr_flags & PACKET_HDR_L4) && (packet_set_cont(buf, sizeof(tcp_hdr_t)) < 0)) {
         log_error(LOG_TCP, "set cont failed.");
         return -1;
     }
-    tcp_hdr = (tcp_hdr_t *)packet_data(buf);
+    tcp_hdr_t * tcp_hdr = (tcp_hdr_t *)packet_data(buf);
     if (tcp_hdr->checksum) {
         packet_reset_pos(buf);
-        if (checksum_peso(dest_ip->a_addr, src_ip->a_addr, NET_PROTOCOL_TCP, buf)) {
+        if (checksum_peso_in(dest_ip->a_addr, src_ip->a_addr, NET_PROTOCOL_TCP, buf)) {
             log_warning(LOG_TCP, "tcp checksum incorrect");
             return NET_ERR_BROKEN;
         }
@@ -125,7 +125,7 @@ net_err_t tcp_in(packet_t *buf, ipaddr_t *src_ip, ipaddr_t *dest_ip) {
     tcp_display_pkt("tcp packet in!", tcp_hdr, buf);
     tcp_seg_t seg;
     tcp_seg_init(&seg, buf, dest_ip, src_ip);
-    tcp_t *tcp = (tcp_t *)tcp_find(dest_ip, tcp_hdr->dport, src_ip, tcp_hdr->sport);
+    tcp_t *tcp = (tcp_t *)tcp_find(buf, dest_ip, tcp_hdr->dport, src_ip, tcp_hdr->sport);
     if (!tcp || (tcp->state >= TCP_STATE_MAX)) {
         log_error(LOG_TCP, "no tcp found: port = %d", tcp_hdr->dport);
         tcp_send_reset(&seg);
@@ -167,6 +167,9 @@ static int copy_data_to_rcvbuf(tcp_t * tcp, tcp_seg_t * seg) {
         // copy data to rcv buffer, we do not support hole yet
         // tcp_buf_write_rcv() will truncate the data if it is too long
         return tcp_buf_write_rcv(&tcp->rcv.buf, doffset, buf, seg->data_len);
+    } else if (seg->data_len && (doffset > 0)) {
+        // a segment beyond rcv.nxt, dropped until reassembly is supported
+        tcp->stats.ooo_drops++;
     }
     return 0;
 }
@@ -188,6 +191,7 @@ net_err_t tcp_data_in (tcp_t * tcp, tcp_seg_t * seg) {
     int wakeup = 0;
     if (size) {
         tcp->rcv.nxt += size ;
+        tcp->stats.bytes_received += size;
         wakeup++;
     }
     tcp_hdr_t * tcp_hdr = seg->hdr;
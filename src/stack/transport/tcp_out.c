@@ -5,6 +5,11 @@
 #include "ipv4.h"
 #include "log.h"
 #include "tcp_out.h"
+#include "memory_pool.h"
+#include "net_config.h"
+
+static tcp_zc_t zc_tbl[TCP_MAX_NR * TCP_ZC_MAX_NR];
+static memory_pool_t zc_mblock;            // zero-copy sends, freed by the thread dropping the last reference
 
 /**
  * because the header length unit is 4 bytes
@@ -36,8 +41,10 @@ static void write_sync_option (tcp_t * tcp, packet_t * buf) {
 /**
  * convert endianness of tcp header, and calculate checksum
  * then send via ipv4_out
+ * data_sum is the sum of the data after the header taken while copying it,
+ * if it is null the checksum is left to the driver
  * */
-static net_err_t send_out (tcp_hdr_t * out, packet_t * buf, ipaddr_t * dest, ipaddr_t * src) {
+static net_err_t send_out_sum (tcp_hdr_t * out, packet_t * buf, ipaddr_t * dest, ipaddr_t * src, const uint32_t * data_sum) {
     tcp_display_pkt("tcp out", out, buf);
     out->sport = e_htons(out->sport);
     out->dport = e_htons(out->dport);
@@ -47,7 +54,11 @@ static net_err_t send_out (tcp_hdr_t * out, packet_t * buf, ipaddr_t * dest, ipa
     out->urgptr = e_htons(out->urgptr);
 
     out->checksum = 0;
-    out->checksum = checksum_peso(dest->a_addr, src->a_addr, NET_PROTOCOL_TCP, buf);
+    if (data_sum) {
+        out->checksum = checksum_peso_part(dest->a_addr, src->a_addr, NET_PROTOCOL_TCP, buf, tcp_hdr_size(out), *data_sum);
+    } else {
+        checksum_peso_defer(dest->a_addr, src->a_addr, NET_PROTOCOL_TCP, buf, &out->checksum);
+    }
 
     net_err_t err = ipv4_out(NET_PROTOCOL_TCP, dest, src, buf);
     if (err < 0) {
@@ -58,6 +69,10 @@ static net_err_t send_out (tcp_hdr_t * out, packet_t * buf, ipaddr_t * dest, ipa
     return err;
 }
 
+static net_err_t send_out (tcp_hdr_t * out, packet_t * buf, ipaddr_t * dest, ipaddr_t * src) {
+    return send_out_sum(out, buf, dest, src, (uint32_t *)0);
+}
+
 /**
  * about the scenario of sending reset segment:
  * https://www.ibm.com/support/pages/tcpip-sockets-reset-concerns
@@ -76,7 +91,7 @@ net_err_t tcp_send_reset(tcp_seg_t * seg) {
     }
 
     // allocate a packet buffer, and fill in the TCP header
-    packet_t* buf = packet_alloc(sizeof(tcp_hdr_t));
+    packet_t* buf = packet_alloc_headroom(sizeof(tcp_hdr_t), IPV4_HEADROOM);
     if (!buf) {
         log_warning(LOG_TCP, "no pktbuf");
         return NET_ERR_NONE;
@@ -121,24 +136,77 @@ static void get_send_info (tcp_t * tcp,  int rexmit, int * doff, int * dlen) {
     if (rexmit) {
         // if retransmitting, send the data from the start of the buffer
         *doff = 0;
-        *dlen = tcp_buf_cnt(&tcp->snd.buf) - *doff;
+        *dlen = tcp_snd_cnt(tcp) - *doff;
     } else {
         // if not retransmitting, send the data from the nxt seq number
         *doff = tcp->flags.syn_out ? 0 : tcp->snd.nxt - tcp->snd.una;
-        *dlen = tcp_buf_cnt(&tcp->snd.buf) - *doff;
+        *dlen = tcp_snd_cnt(tcp) - *doff;
     }
     // if the data length is greater than MSS, truncate it
     *dlen = (*dlen > tcp->mss) ? tcp->mss : *dlen;
 }
 
 
+net_err_t tcp_zc_init(void) {
+    return memory_pool_init_grow(&zc_mblock, zc_tbl, sizeof(tcp_zc_t), TCP_MAX_NR * TCP_ZC_MAX_NR,
+                                 net_config()->tcp_cnt * TCP_ZC_MAX_NR, LOCKER_THREAD, 0);
+}
+
+/**
+ * drop a reference of a zero-copy send, by the socket or by the release of a page
+ */
+static void tcp_zc_put (void * arg) {
+    tcp_zc_t * zc = (tcp_zc_t *)arg;
+    if (sys_atomic_add(&zc->ref, -1) == 0) {
+        memory_pool_free(&zc_mblock, zc);
+    }
+}
+
+/**
+ * reference zero-copy user buffers from the packet as external pages,
+ * each page holds a reference on its buffer until it is freed
+ */
+int tcp_zc_ref_data (tcp_t * tcp, packet_t * packet, int doff, int dlen) {
+    int offset = doff + tcp->snd.zc.acked;
+    int idx = tcp->snd.zc.out;
+    int remain = dlen;
+    for (int i = 0; (i < tcp->snd.zc.cnt) && remain; i++) {
+        tcp_zc_t * zc = tcp->snd.zc.tbl[idx];
+        idx = (idx + 1) % TCP_ZC_MAX_NR;
+        if (offset >= zc->size) {
+            offset -= zc->size;
+            continue;
+        }
+        int curr_size = zc->size - offset;
+        curr_size = (curr_size > remain) ? remain : curr_size;
+        net_err_t err = packet_add_ext(packet, zc->data + offset, curr_size);
+        if (err < 0) {
+            log_error(LOG_TCP, "add ext page error");
+            return -1;
+        }
+        page_t * page = packet_last_page(packet);
+        sys_atomic_add(&zc->ref, 1);
+        page->release = tcp_zc_put;
+        page->release_arg = zc;
+        offset = 0;
+        remain -= curr_size;
+    }
+    return dlen - remain;
+}
+
+
 /**
  * copy data from socket buffer to packet buffer
+ * the data is summed while copied, *summed tells if data_sum holds its checksum
  */
-static int copy_send_data (tcp_t * tcp, packet_t * packet, int doff, int dlen) {
+static int copy_send_data (tcp_t * tcp, packet_t * packet, int doff, int dlen, uint32_t * data_sum, int * summed) {
+    *summed = 0;
     if (dlen == 0) {
         return 0;
     }
+    if (tcp->snd.zc.cnt) {
+        return tcp_zc_ref_data(tcp, packet, doff, dlen);
+    }
     net_err_t err = packet_resize(packet, (int)(packet->total_size + dlen));
     if (err < 0) {
         log_error(LOG_TCP, "pktbuf resize error");
@@ -148,7 +216,9 @@ static int copy_send_data (tcp_t * tcp, packet_t * packet, int doff, int dlen) {
     int hdr_size = tcp_hdr_size((tcp_hdr_t *)packet_data(packet));
     packet_reset_pos(packet);
     packet_seek(packet, hdr_size);
-    tcp_buf_read_send(&tcp->snd.buf, doff, packet, dlen);
+    *data_sum = 0;
+    tcp_buf_read_send(&tcp->snd.buf, doff, packet, dlen, data_sum);
+    *summed = 1;
     return dlen;
 }
 
@@ -170,14 +240,14 @@ net_err_t tcp_transmit(tcp_t * tcp) {
     if (tcp->flags.syn_out) {
         seq_len++;
     }
-    if ((tcp_buf_cnt(&tcp->snd.buf) == 0) && tcp->flags.fin_out) {
+    if ((tcp_snd_cnt(tcp) == 0) && tcp->flags.fin_out) {
         seq_len++;
     }
     // this is to prevent duplicate empty ACKs, but allow empty FIN and SYN
     if (seq_len == 0) {
         return NET_OK;
     }
-    packet_t* buf = packet_alloc(sizeof(tcp_hdr_t));
+    packet_t* buf = packet_alloc_headroom(sizeof(tcp_hdr_t), IPV4_HEADROOM);
     if (!buf) {
         log_error(LOG_TCP, "no buffer");
         return NET_OK;
@@ -193,7 +263,7 @@ net_err_t tcp_transmit(tcp_t * tcp) {
     hdr->f_ack = tcp->flags.irs_valid;
     // if the buffer is not empty, do not send FIN
     if (tcp->flags.fin_out) {
-        hdr->f_fin = (tcp_buf_cnt(&tcp->snd.buf) == 0) ? 1 : 0;
+        hdr->f_fin = (tcp_snd_cnt(tcp) == 0) ? 1 : 0;
     }
     if (hdr->f_syn) {
         write_sync_option(tcp, buf);
@@ -201,10 +271,18 @@ net_err_t tcp_transmit(tcp_t * tcp) {
     hdr->win = (uint16_t)tcp_rcv_window(tcp);
     hdr->urgptr = 0;
     tcp_set_hdr_size(hdr, buf->total_size);
-    copy_send_data(tcp, buf, doff, dlen);
+    uint32_t data_sum;
+    int summed;
+    copy_send_data(tcp, buf, doff, dlen, &data_sum, &summed);
+    // time one segment at a time for the rtt estimation
+    if ((dlen > 0) && !tcp->snd.rtt_timing) {
+        tcp->snd.rtt_timing = 1;
+        tcp->snd.rtt_seq = tcp->snd.nxt + dlen;
+        sys_time_curr(&tcp->snd.rtt_start);
+    }
     // move the seq forward
     tcp->snd.nxt += dlen + hdr->f_syn + hdr->f_fin;
-    return send_out(hdr, buf, &tcp->base.remote_ip, &tcp->base.local_ip);
+    return send_out_sum(hdr, buf, &tcp->base.remote_ip, &tcp->base.local_ip, summed ? &data_sum : (uint32_t *)0);
 }
 
 /**
@@ -217,6 +295,100 @@ net_err_t tcp_send_syn(tcp_t* tcp) {
 }
 
 
+/**
+ * complete the acked zero-copy sends no packet references any more, in the order of their ids
+ * return the number of acked sends still waiting for packets to be freed
+ */
+int tcp_zc_complete (tcp_t * tcp) {
+    int acked = (int)(tcp->snd.zc.next_id - tcp->snd.zc.done_id) - tcp->snd.zc.cnt;
+    while (acked && (tcp->snd.zc.tbl[tcp->snd.zc.done]->ref == 1)) {
+        tcp_zc_put(tcp->snd.zc.tbl[tcp->snd.zc.done]);
+        tcp->snd.zc.done = (tcp->snd.zc.done + 1) % TCP_ZC_MAX_NR;
+        tcp->snd.zc.done_id++;
+        acked--;
+    }
+    return acked;
+}
+
+/**
+ * the packets referencing acked buffers are freed by other threads, check them until they are gone
+ */
+static void tcp_zc_tmo (struct _net_timer_t* timer, void * arg) {
+    tcp_t * tcp = (tcp_t *)arg;
+    uint32_t done_id = tcp->snd.zc.done_id;
+    if (tcp_zc_complete(tcp)) {
+        net_timer_add(timer, "zc", tcp_zc_tmo, tcp, TCP_ZC_POLL_TMO, 0);
+    }
+    if (tcp->snd.zc.done_id != done_id) {
+        // the ring has room for more sends
+        sock_wakeup(&tcp->base, SOCK_WAIT_WRITE, NET_OK);
+    }
+}
+
+/**
+ * drop the references of the socket on its zero-copy sends, those still in packets
+ * are freed with the last of their pages
+ */
+void tcp_zc_free (tcp_t * tcp) {
+    net_timer_remove(&tcp->snd.zc.timer);
+    int cnt = (int)(tcp->snd.zc.next_id - tcp->snd.zc.done_id);
+    for (int i = 0; i < cnt; i++) {
+        tcp_zc_put(tcp->snd.zc.tbl[(tcp->snd.zc.done + i) % TCP_ZC_MAX_NR]);
+    }
+    tcp->snd.zc.cnt = 0;
+    tcp->snd.zc.count = 0;
+    tcp->snd.zc.done_id = tcp->snd.zc.next_id;
+}
+
+/**
+ * remove acked data from the send queue, return the number of bytes removed
+ * a zero-copy send is completed once all of its buffer is acked and no packet references it
+ */
+int tcp_snd_remove (tcp_t * tcp, int cnt) {
+    if (tcp->snd.zc.cnt == 0) {
+        return tcp_buf_remove(&tcp->snd.buf, cnt);
+    }
+
+    int removed = 0;
+    while (cnt && tcp->snd.zc.cnt) {
+        tcp_zc_t * zc = tcp->snd.zc.tbl[tcp->snd.zc.out];
+        int curr_size = zc->size - tcp->snd.zc.acked;
+        curr_size = (curr_size > cnt) ? cnt : curr_size;
+        tcp->snd.zc.acked += curr_size;
+        tcp->snd.zc.count -= curr_size;
+        removed += curr_size;
+        cnt -= curr_size;
+        if (tcp->snd.zc.acked == zc->size) {
+            tcp->snd.zc.out = (tcp->snd.zc.out + 1) % TCP_ZC_MAX_NR;
+            tcp->snd.zc.cnt--;
+            tcp->snd.zc.acked = 0;
+        }
+    }
+    if (tcp_zc_complete(tcp)) {
+        net_timer_remove(&tcp->snd.zc.timer);
+        net_timer_add(&tcp->snd.zc.timer, "zc", tcp_zc_tmo, tcp, TCP_ZC_POLL_TMO, 0);
+    }
+    return removed;
+}
+
+
+/**
+ * update srtt and rttvar with a new sample, RFC 6298 section 2
+ * the estimation is only reported through TCP_INFO, rto is not derived from it yet
+ */
+void tcp_rtt_sample (tcp_t * tcp, int rtt) {
+    if (tcp->snd.srtt == 0) {
+        tcp->snd.srtt = rtt ? rtt : 1;
+        tcp->snd.rttvar = rtt / 2;
+    } else {
+        int delta = tcp->snd.srtt - rtt;
+        delta = (delta < 0) ? -delta : delta;
+        tcp->snd.rttvar = (3 * tcp->snd.rttvar + delta) / 4;
+        tcp->snd.srtt = (7 * tcp->snd.srtt + rtt) / 8;
+    }
+}
+
+
 /**
  * seg is an input segment, which has ACK flag set
  * we need to update window variables based on it
@@ -224,8 +396,13 @@ net_err_t tcp_send_syn(tcp_t* tcp) {
  * */
 net_err_t tcp_ack_process (tcp_t * tcp, tcp_seg_t * seg) {
     tcp_hdr_t * tcp_hdr = seg->hdr;
+    tcp->snd.wnd = tcp_hdr->win;
     // una < ack <= nxt, remember ack is the seq number 'expected' next
     if (TCP_SEQ_LE(tcp_hdr->ack, tcp->snd.una)) {
+        // a pure ack that doesn't move una while data is outstanding is a duplicate
+        if ((tcp_hdr->ack == tcp->snd.una) && (seg->data_len == 0) && (tcp->snd.una != tcp->snd.nxt)) {
+            tcp->stats.dup_acks++;
+        }
         // if the ack is for old data, just ignore it
         return NET_OK;
     } else if (TCP_SEQ_LT(tcp->snd.nxt, tcp_hdr->ack)) {
@@ -243,9 +420,14 @@ net_err_t tcp_ack_process (tcp_t * tcp, tcp_seg_t * seg) {
     int unacked_cnt = tcp->snd.nxt - tcp->snd.una;
     int curr_acked = (acked_cnt > unacked_cnt) ? unacked_cnt : acked_cnt;
     log_info(LOG_TCP, "curr_acked %d, unacked %d acked %d", curr_acked, unacked_cnt, acked_cnt);
+    if (tcp->snd.rtt_timing && TCP_SEQ_LE(tcp->snd.rtt_seq, tcp_hdr->ack)) {
+        tcp->snd.rtt_timing = 0;
+        tcp_rtt_sample(tcp, sys_time_goes(&tcp->snd.rtt_start));
+    }
     if (curr_acked > 0) {
+        tcp->stats.bytes_acked += curr_acked;
         tcp->snd.una += curr_acked;
-        curr_acked -= tcp_buf_remove(&tcp->snd.buf, curr_acked);
+        curr_acked -= tcp_snd_remove(tcp, curr_acked);
         // if the ack is for FIN, then clear the fin_out flag
         if (curr_acked && (tcp->flags.fin_out)) {
             tcp->flags.fin_out = 0;
@@ -264,7 +446,7 @@ net_err_t tcp_send_ack(tcp_t* tcp, tcp_seg_t * seg) {
     if (seg->hdr->f_rst) {
         return NET_OK;
     }
-    packet_t* buf = packet_alloc(sizeof(tcp_hdr_t));
+    packet_t* buf = packet_alloc_headroom(sizeof(tcp_hdr_t), IPV4_HEADROOM);
     if (!buf) {
         log_error(LOG_TCP, "no buffer");
         return NET_ERR_NONE;
@@ -298,6 +480,10 @@ net_err_t tcp_send_fin (tcp_t* tcp) {
 
 
 int tcp_write_sndbuf(tcp_t * tcp, const uint8_t * buf, int len) {
+    if (tcp->snd.zc.cnt) {
+        // wait for the zero-copy sends to be acked, so that the stream stays in order
+        return 0;
+    }
     int free_cnt = tcp_buf_free_cnt(&tcp->snd.buf);
     if (free_cnt <= 0) {
         // if there is no free space in the send buffer, return 0
@@ -311,8 +497,37 @@ int tcp_write_sndbuf(tcp_t * tcp, const uint8_t * buf, int len) {
 
 
 
+/**
+ * queue the user buffer for sending without copying it
+ * the buffer is referenced until the send is completed, return len or 0 if it has to wait
+ */
+int tcp_write_zc(tcp_t * tcp, const uint8_t * buf, int len) {
+    if (tcp_buf_cnt(&tcp->snd.buf)) {
+        return 0;
+    }
+    tcp_zc_complete(tcp);
+    if ((int)(tcp->snd.zc.next_id - tcp->snd.zc.done_id) >= TCP_ZC_MAX_NR) {
+        return 0;
+    }
+    tcp_zc_t * zc = (tcp_zc_t *)memory_pool_alloc(&zc_mblock, -1);
+    if (!zc) {
+        log_error(LOG_TCP, "no zero-copy send available");
+        return 0;
+    }
+    zc->data = buf;
+    zc->size = len;
+    zc->ref = 1;
+    int idx = (tcp->snd.zc.out + tcp->snd.zc.cnt) % TCP_ZC_MAX_NR;
+    tcp->snd.zc.tbl[idx] = zc;
+    tcp->snd.zc.cnt++;
+    tcp->snd.zc.count += len;
+    tcp->snd.zc.next_id++;
+    return len;
+}
+
+
 net_err_t tcp_send_reset_for_tcp(tcp_t* tcp) {
-    packet_t* buf = packet_alloc(sizeof(tcp_hdr_t));
+    packet_t* buf = packet_alloc_headroom(sizeof(tcp_hdr_t), IPV4_HEADROOM);
     if (!buf) {
         log_error(LOG_TCP, "no buffer");
         return NET_ERR_NONE;
@@ -333,7 +548,7 @@ net_err_t tcp_send_reset_for_tcp(tcp_t* tcp) {
 
 
 net_err_t tcp_send_keepalive(tcp_t* tcp) {
-    packet_t* buf = packet_alloc(sizeof(tcp_hdr_t));
+    packet_t* buf = packet_alloc_headroom(sizeof(tcp_hdr_t), IPV4_HEADROOM);
     if (!buf) {
         log_error(LOG_TCP, "no buffer");
         return NET_ERR_NONE;
@@ -386,7 +601,10 @@ net_err_t tcp_retransmit(tcp_t* tcp) {
     if (seq_len == 0) {
         return NET_OK;
     }
-    packet_t* buf = packet_alloc(sizeof(tcp_hdr_t));
+    // Karn's algorithm: do not take rtt samples from retransmitted segments
+    tcp->snd.rtt_timing = 0;
+    tcp->stats.total_retrans++;
+    packet_t* buf = packet_alloc_headroom(sizeof(tcp_hdr_t), IPV4_HEADROOM);
     if (!buf) {
         log_error(LOG_TCP, "no buffer");
         return NET_OK;
@@ -406,19 +624,21 @@ net_err_t tcp_retransmit(tcp_t* tcp) {
     hdr->win = (uint16_t)tcp_rcv_window(tcp);
     hdr->urgptr = 0;
     tcp_set_hdr_size(hdr, buf->total_size);
-    copy_send_data(tcp, buf, doff, dlen);
+    uint32_t data_sum;
+    int summed;
+    copy_send_data(tcp, buf, doff, dlen, &data_sum, &summed);
 
     // do not send FIN, when there is still data in buffer
     log_info(LOG_TCP, "tcp fin flag %d", tcp->flags.fin_out);
     if (tcp->flags.fin_out) {
-        hdr->f_fin = (tcp_buf_cnt(&tcp->snd.buf) == 0) ? 1 : 0;
+        hdr->f_fin = (tcp_snd_cnt(tcp) == 0) ? 1 : 0;
     }
     // if there is new data to be sent, send it together with the retransmission
     int diff = tcp->snd.una + dlen - tcp->snd.nxt;
     tcp->snd.nxt += diff > 0 ? diff: 0;
     log_info(LOG_TCP, "tcp send: syn %d fin %d seq %u, ack %u, dlen %d, seqlen: %d, %s",
              hdr->f_fin,hdr->f_syn,hdr->seq, hdr->ack, 0, seq_len, tcp_ostate_name(tcp));
-    return send_out(hdr, buf, &tcp->base.remote_ip, &tcp->base.local_ip);
+    return send_out_sum(hdr, buf, &tcp->base.remote_ip, &tcp->base.local_ip, summed ? &data_sum : (uint32_t *)0);
 }
 
 
@@ -534,7 +754,7 @@ static void tcp_ostate_sending_in (tcp_t * tcp, tcp_oevent_t event) {
             // check if all data has been acked, if so enter idle state
             // be careful when una == nxt, because FIN is sent after all data is acked
             if ((tcp->snd.una == tcp->snd.nxt) || tcp->flags.fin_out) {
-                if (tcp_buf_cnt(&tcp->snd.buf) || tcp->flags.fin_out) {
+                if (tcp_snd_cnt(tcp) || tcp->flags.fin_out) {
                     tcp_transmit(tcp);
                     tcp_set_ostate(tcp, TCP_OSTATE_SENDING);
                 } else {
@@ -555,7 +775,7 @@ static void tcp_ostate_rexmit_in (tcp_t * tcp, tcp_oevent_t event) {
     switch (event) {
         case TCP_OEVENT_SEND: {
             if ((tcp->snd.una == tcp->snd.nxt) || tcp->flags.fin_out) {
-                if (tcp_buf_cnt(&tcp->snd.buf) || tcp->flags.fin_out) {
+                if (tcp_snd_cnt(tcp) || tcp->flags.fin_out) {
                     tcp_transmit(tcp);
                     tcp_set_ostate(tcp, TCP_OSTATE_SENDING);
                 } else {
@@ -4,11 +4,18 @@
 #include "utils.h"
 #include "ipv4.h"
 #include "protocols.h"
+#include "net_config.h"
 
 static udp_t udp_tbl[UDP_MAX_NR];
 static memory_pool_t udp_mblock;
 static list_t udp_list;
 
+// lookup tables, connected sockets are keyed by the four-tuple, the others by local port
+static list_t udp_conn_hash[UDP_HASH_SIZE];
+static list_t udp_port_hash[UDP_HASH_SIZE];
+// every socket with a local port, keyed by the port, to find the ip-port pairs in use
+static list_t udp_bind_hash[UDP_HASH_SIZE];
+
 
 
 #if LOG_DISP_ENABLED(LOG_UDP)
@@ -45,14 +52,74 @@ static void display_udp_list (void)
 
 net_err_t udp_init(void) {
     log_info(LOG_UDP, "udp init.");
-    memory_pool_init(&udp_mblock, udp_tbl, sizeof(udp_t), UDP_MAX_NR, LOCKER_NONE);
+    memory_pool_init_grow(&udp_mblock, udp_tbl, sizeof(udp_t), UDP_MAX_NR, net_config()->udp_cnt, LOCKER_NONE,
+                          (net_config()->huge_pages & NET_HUGE_SOCKET) ? MEM_ARENA_HUGE : 0);
     init_list(&udp_list);
+    for (int i = 0; i < UDP_HASH_SIZE; i++) {
+        init_list(udp_conn_hash + i);
+        init_list(udp_port_hash + i);
+        init_list(udp_bind_hash + i);
+    }
 
     log_info(LOG_UDP, "init done.");
     return NET_OK;
 }
 
 
+// room for the udp, ipv4 and link headers in front of a datagram
+#define UDP_HEADROOM            (IPV4_HEADROOM + (int)sizeof(udp_hdr_t))
+
+static inline int udp_port_hashfn(uint16_t local_port) {
+    return local_port % UDP_HASH_SIZE;
+}
+
+static inline int udp_conn_hashfn(uint16_t local_port, const ipaddr_t * remote_ip, uint16_t remote_port) {
+    uint32_t key = remote_ip->q_addr ^ ((uint32_t)local_port << 16) ^ remote_port;
+    key ^= key >> 16;
+    key ^= key >> 8;
+    return (int)(key % UDP_HASH_SIZE);
+}
+
+static inline int udp_is_connected(sock_t * sock) {
+    return !ipaddr_is_any(&sock->remote_ip) && sock->remote_port;
+}
+
+/**
+ * take the socket out of the lookup and bind tables
+ */
+static void udp_unhash(udp_t * udp) {
+    if (udp->bucket) {
+        list_remove(udp->bucket, &udp->hash_node);
+        udp->bucket = (list_t *)0;
+    }
+    if (udp->bind_bucket) {
+        list_remove(udp->bind_bucket, &udp->bind_node);
+        udp->bind_bucket = (list_t *)0;
+    }
+}
+
+/**
+ * put the socket into the lookup table that matches its current addresses
+ * must be called whenever the local port or the remote address changes
+ */
+static void udp_rehash(udp_t * udp) {
+    sock_t * sock = (sock_t *)udp;
+    udp_unhash(udp);
+    if (sock->local_port == NET_PORT_EMPTY) {
+        return;
+    }
+    udp->bind_bucket = udp_bind_hash + udp_port_hashfn(sock->local_port);
+    list_insert_last(udp->bind_bucket, &udp->bind_node);
+
+    if (udp_is_connected(sock)) {
+        udp->bucket = udp_conn_hash + udp_conn_hashfn(sock->local_port, &sock->remote_ip, sock->remote_port);
+    } else {
+        udp->bucket = udp_port_hash + udp_port_hashfn(sock->local_port);
+    }
+    list_insert_last(udp->bucket, &udp->hash_node);
+}
+
+
 static int is_port_used(int port) {
     list_node_t * node;
 
@@ -80,6 +147,109 @@ static net_err_t alloc_port(sock_t* sock) {
 
 
 
+/**
+ * data_sum is the sum of the data in buf taken by packet_write_csum, only the header is summed here,
+ * when it is null the checksum is left to the driver
+ * */
+static net_err_t udp_out_sum(ipaddr_t * dest, uint16_t dport, ipaddr_t * src, uint16_t sport, packet_t * buf,
+                             const uint32_t * data_sum) {
+    log_info(LOG_UDP, "send an udp packet!");
+
+    // if the src is null, use the route table to find the src ip of interface
+    if (!src || ipaddr_is_any(src)) {
+        rentry_t* rt = rt_find(dest);
+        if (rt == (rentry_t*)0) {
+            dbg_dump_ip(LOG_UDP, "no route to dest: ", dest);
+            return NET_ERR_UNREACH;
+        }
+        src = &rt->netif->ipaddr;
+    }
+    net_err_t err = packet_add_header(buf, sizeof(udp_hdr_t), 1);
+    if (err < 0) {
+        log_error(LOG_UDP, "add header failed. err = %d", err);
+        return NET_ERR_SIZE;
+    }
+
+    udp_hdr_t * udp_hdr = (udp_hdr_t*)packet_data(buf);
+    udp_hdr->src_port = sport;
+    udp_hdr->dest_port = dport;
+    udp_hdr->total_len = buf->total_size;
+    udp_hdr->src_port = e_htons(udp_hdr->src_port);
+    udp_hdr->dest_port = e_htons(udp_hdr->dest_port);
+    udp_hdr->total_len = e_htons(udp_hdr->total_len);
+    udp_hdr->checksum = 0;
+    if (data_sum) {
+        udp_hdr->checksum = checksum_peso_part(src->a_addr, dest->a_addr, NET_PROTOCOL_UDP, buf,
+                                               sizeof(udp_hdr_t), *data_sum);
+    } else {
+        checksum_peso_defer(src->a_addr, dest->a_addr, NET_PROTOCOL_UDP, buf, &udp_hdr->checksum);
+    }
+    err = ipv4_out(NET_PROTOCOL_UDP, dest, src, buf);
+    if (err < 0) {
+        log_error(LOG_UDP, "udp out error, err = %d", err);
+        return err;
+    }
+
+    return err;
+}
+
+
+/**
+ * UDP_SEGMENT: split buf into datagrams of gso_size bytes, the last one may be shorter
+ * all datagrams share one route lookup and one header template.
+ * *sent is the number of bytes of the datagrams sent before an error
+ */
+static net_err_t udp_out_segments(udp_t * udp, ipaddr_t * dest, uint16_t dport, const uint8_t * buf, int len, int * sent) {
+    sock_t * sock = (sock_t *)udp;
+    int seg_size = udp->gso_size;
+    *sent = 0;
+    if ((len + seg_size - 1) / seg_size > UDP_MAX_SEGS) {
+        log_error(LOG_UDP, "too many segments: %d / %d", len, seg_size);
+        return NET_ERR_SIZE;
+    }
+
+    rentry_t* rt = rt_find(dest);
+    if (rt == (rentry_t*)0) {
+        dbg_dump_ip(LOG_UDP, "no route to dest: ", dest);
+        return NET_ERR_UNREACH;
+    }
+    ipaddr_t * src = ipaddr_is_any(&sock->local_ip) ? &rt->netif->ipaddr : &sock->local_ip;
+
+    udp_hdr_t template;
+    template.src_port = e_htons(sock->local_port);
+    template.dest_port = e_htons(dport);
+    template.checksum = 0;
+
+    while (len > 0) {
+        int curr_size = (len > seg_size) ? seg_size : len;
+        packet_t * pktbuf = packet_alloc_headroom((int)sizeof(udp_hdr_t) + curr_size, IPV4_HEADROOM);
+        if (!pktbuf) {
+            log_error(LOG_UDP, "no buffer");
+            return NET_ERR_MEM;
+        }
+
+        template.total_len = e_htons((uint16_t)(sizeof(udp_hdr_t) + curr_size));
+        packet_write(pktbuf, (uint8_t *)&template, sizeof(udp_hdr_t));
+        uint32_t data_sum = 0;
+        packet_write_csum(pktbuf, (uint8_t *)buf, curr_size, &data_sum);
+
+        udp_hdr_t * udp_hdr = (udp_hdr_t *)packet_data(pktbuf);
+        udp_hdr->checksum = checksum_peso_part(src->a_addr, dest->a_addr, NET_PROTOCOL_UDP, pktbuf,
+                                               sizeof(udp_hdr_t), data_sum);
+        net_err_t err = ipv4_out_rt(NET_PROTOCOL_UDP, dest, src, pktbuf, rt);
+        if (err < 0) {
+            log_error(LOG_UDP, "udp out error, err = %d", err);
+            packet_free(pktbuf);
+            return err;
+        }
+        buf += curr_size;
+        len -= curr_size;
+        *sent += curr_size;
+    }
+    return NET_OK;
+}
+
+
 /**
  * API consumer may not specify the local port, we need to allocate one,
  * the local ip address may also be null, we need to lookup route table
@@ -101,23 +271,45 @@ net_err_t udp_sendto (struct _sock_t * sock, const void* buf, size_t len, int fl
     }
 
     // there might be no local port bound yet, allocate one
-    if (!sock->local_port && ((sock->err = alloc_port(sock)) < 0)) {
-        log_error(LOG_UDP, "no port avaliable");
-        return NET_ERR_NONE;
+    if (!sock->local_port) {
+        if ((sock->err = alloc_port(sock)) < 0) {
+            log_error(LOG_UDP, "no port avaliable");
+            return NET_ERR_NONE;
+        }
+        udp_rehash((udp_t *)sock);
+    }
+
+    udp_t * udp = (udp_t *)sock;
+    if (udp->gso_size && ((int)len > udp->gso_size)) {
+        int sent;
+        net_err_t err = udp_out_segments(udp, &dest_ip, dport, (const uint8_t *)buf, (int)len, &sent);
+        if (err < 0) {
+            log_error(LOG_UDP, "send segments error, %d bytes sent", sent);
+            if (sent == 0) {
+                return err;
+            }
+        }
+        // like a partial write, the caller sees how much went out
+        if (result_len) {
+            *result_len = (ssize_t)sent;
+        }
+        return NET_OK;
     }
 
-    packet_t* pktbuf = packet_alloc((int)len);
+    packet_t* pktbuf = packet_alloc_headroom((int)len, UDP_HEADROOM);
     if (!pktbuf) {
         log_error(LOG_UDP, "no buffer");
         return NET_ERR_MEM;
     }
 
-    net_err_t err = packet_write(pktbuf, (uint8_t*)buf, (int)len);
+    // sum the data while copying it, so udp_out doesn't walk it again
+    uint32_t data_sum = 0;
+    net_err_t err = packet_write_csum(pktbuf, (uint8_t*)buf, (int)len, &data_sum);
     if (err < 0) {
         log_error(LOG_UDP, "copy data error");
         goto end_sendto;
     }
-    err = udp_out(&dest_ip, dport, &sock->local_ip, sock->local_port, pktbuf);
+    err = udp_out_sum(&dest_ip, dport, &sock->local_ip, sock->local_port, pktbuf, &data_sum);
     if (err < 0) {
         log_error(LOG_UDP, "send error");
         goto end_sendto;
@@ -152,15 +344,16 @@ net_err_t udp_bind(sock_t* sock, const struct x_sockaddr* addr, x_socklen_t len)
     ipaddr_from_buf(&local_ip, (const uint8_t *)&addr_in->sin_addr.addr_array);
     int port = e_ntohs(addr_in->sin_port);
 
-    // iterate the allocated sockets to check if there exists the same ip-port pair
+    // check the sockets on the same port, connected or not, if there exists the same ip-port pair
+    // the pair can be shared only if both sockets have SO_REUSEPORT set
     list_node_t* node;
     udp_t* udp = (udp_t*)0;
-    list_for_each(node, &udp_list) {
-        udp_t* u = (udp_t *)list_entry(node, sock_t, node);
-        if ((sock_t*)u == sock) {
+    list_for_each(node, udp_bind_hash + udp_port_hashfn(port)) {
+        udp_t* u = list_entry(node, udp_t, bind_node);
+        if (u->base.reuseport && sock->reuseport) {
             continue;
         }
-        if (ipaddr_is_equal(&sock->local_ip, &local_ip) && (sock->local_port == port)) {
+        if (ipaddr_is_equal(&u->base.local_ip, &local_ip) && (u->base.local_port == port)) {
             udp = u;
             break;
         }
@@ -171,29 +364,73 @@ net_err_t udp_bind(sock_t* sock, const struct x_sockaddr* addr, x_socklen_t len)
     } else {
         // bind the socket, just set the local ip and port
         sock_bind(sock, addr, len);
+        udp_rehash((udp_t *)sock);
     }
     display_udp_list();
     return NET_OK;
 }
 
 
+/**
+ * take the first datagram out of the receive queue, and give back its memory to SO_RCVBUF
+ */
+static packet_t * udp_dequeue(udp_t * udp) {
+    list_node_t * first = list_remove_first(&udp->recv_list);
+    if (!first) {
+        return (packet_t *)0;
+    }
+    packet_t * pktbuf = list_entry(first, packet_t, node);
+    udp->rcv_used -= packet_footprint(pktbuf);
+    return pktbuf;
+}
+
+
+/**
+ * with UDP_GRO, take the datagrams queued after the first one as long as they are from the same sender,
+ * all of the same size except the last one may be shorter, and fit in the user buffer
+ */
+static int udp_coalesce(udp_t * udp, udp_from_t * first, int seg_size, uint8_t * buf, int len) {
+    int total = 0;
+    int last_size = seg_size;
+    list_node_t * node;
+    while ((last_size == seg_size) && (node = list_first(&udp->recv_list))) {
+        packet_t * pktbuf = list_entry(node, packet_t, node);
+        udp_from_t * from = (udp_from_t *)packet_data(pktbuf);
+        int size = pktbuf->total_size - (int)sizeof(udp_from_t);
+        if ((from->port != first->port) || !ipaddr_is_equal(&from->from, &first->from)
+            || (size > seg_size) || (total + size > len)) {
+            break;
+        }
+
+        udp_dequeue(udp);
+        packet_reset_pos(pktbuf);
+        packet_seek(pktbuf, sizeof(udp_from_t));
+        packet_read(pktbuf, buf + total, size);
+        packet_free(pktbuf);
+        total += size;
+        last_size = size;
+    }
+    return total;
+}
+
+
 net_err_t udp_recvfrom(sock_t* sock, void* buf, size_t len, int flags,
                        struct x_sockaddr* src, x_socklen_t* addr_len, ssize_t * result_len) {
     udp_t * udp = (udp_t *)sock;
-    list_node_t * first = list_remove_first(&udp->recv_list);
-    if (!first) {
+    packet_t* pktbuf = udp_dequeue(udp);
+    if (!pktbuf) {
         *result_len = 0;
         return NET_ERR_NEED_WAIT;
     }
-    packet_t* pktbuf = list_entry(first, packet_t, node);
-    assert_halt(pktbuf != (packet_t *)0, "pktbuf error");
     udp_from_t* from = (udp_from_t *)packet_data(pktbuf);
     struct x_sockaddr_in* addr = (struct x_sockaddr_in*)src;
     plat_memset(addr, 0, sizeof(struct x_sockaddr));
     addr->sin_family = AF_INET;
     addr->sin_port = e_htons(from->port);     // convert to network byte order
     ipaddr_to_buf(&from->from, addr->sin_addr.addr_array);
+    udp_from_t first_from = *from;
     packet_remove_header(pktbuf, sizeof(udp_from_t));
+    int seg_size = pktbuf->total_size;
     int size = (pktbuf->total_size > (int)len) ? (int)len : pktbuf->total_size;
     packet_reset_pos(pktbuf);
     net_err_t err = packet_read(pktbuf, buf, size);
@@ -203,6 +440,15 @@ net_err_t udp_recvfrom(sock_t* sock, void* buf, size_t len, int flags,
         return err;
     }
     packet_free(pktbuf);
+
+    udp->rcv_seg_size = 0;
+    if (udp->gro && (size == seg_size) && seg_size) {
+        int more = udp_coalesce(udp, &first_from, seg_size, (uint8_t *)buf + size, (int)len - size);
+        if (more) {
+            udp->rcv_seg_size = seg_size;
+            size += more;
+        }
+    }
     if (result_len) {
         *result_len = (ssize_t)size;
     }
@@ -210,28 +456,211 @@ net_err_t udp_recvfrom(sock_t* sock, void* buf, size_t len, int flags,
 }
 
 
+/**
+ * lend the first queued datagram to the application instead of copying it
+ * iov is filled with the pages of the datagram, which is read-only until the handle is released
+ * if iov is not big enough, the datagram stays queued and iovcnt is set to the count needed
+ */
+net_err_t udp_recv_borrow(sock_t * sock, struct x_iovec * iov, int * iovcnt,
+                          struct x_sockaddr* src, ssize_t * result_len, packet_t ** handle) {
+    udp_t * udp = (udp_t *)sock;
+    list_node_t * first = list_first(&udp->recv_list);
+    if (!first) {
+        *result_len = 0;
+        return NET_ERR_NEED_WAIT;
+    }
+    packet_t* pktbuf = list_entry(first, packet_t, node);
+
+    // the first page also holds udp_from_t, which is not part of the data
+    int cnt = 0;
+    int skip = sizeof(udp_from_t);
+    for (page_t * page = packet_first_page(pktbuf); page; page = page_next(page)) {
+        if (page->size > skip) {
+            cnt++;
+        }
+        skip = (page->size > skip) ? 0 : skip - page->size;
+    }
+    if (cnt > *iovcnt) {
+        log_warning(LOG_UDP, "iov too small: %d < %d", *iovcnt, cnt);
+        *iovcnt = cnt;
+        return NET_ERR_SIZE;
+    }
+
+    udp_dequeue(udp);
+    udp_from_t* from = (udp_from_t *)packet_data(pktbuf);
+    struct x_sockaddr_in* addr = (struct x_sockaddr_in*)src;
+    plat_memset(addr, 0, sizeof(struct x_sockaddr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = e_htons(from->port);     // convert to network byte order
+    ipaddr_to_buf(&from->from, addr->sin_addr.addr_array);
+    packet_remove_header(pktbuf, sizeof(udp_from_t));
+
+    cnt = 0;
+    for (page_t * page = packet_first_page(pktbuf); page; page = page_next(page)) {
+        iov[cnt].iov_base = page->data;
+        iov[cnt].iov_len = page->size;
+        cnt++;
+    }
+    *iovcnt = cnt;
+    *result_len = pktbuf->total_size;
+    *handle = pktbuf;
+    list_insert_last(&udp->borrow_list, &pktbuf->node);
+    return NET_OK;
+}
+
+
+/**
+ * take back a datagram lent by udp_recv_borrow, a handle not lent by this socket is rejected
+ */
+net_err_t udp_recv_release(sock_t * sock, packet_t * handle) {
+    udp_t * udp = (udp_t *)sock;
+    list_node_t * node;
+    list_for_each(node, &udp->borrow_list) {
+        if (node == &handle->node) {
+            list_remove(&udp->borrow_list, node);
+            packet_free(handle);
+            return NET_OK;
+        }
+    }
+    log_error(LOG_UDP, "handle %p is not lent by this socket", handle);
+    return NET_ERR_PARAM;
+}
+
+
+/**
+ * segment size of the last receive, 0 if datagrams were not coalesced
+ */
+int udp_rcv_seg_size(sock_t * sock) {
+    return ((udp_t *)sock)->rcv_seg_size;
+}
+
+
+static net_err_t udp_setopt(struct _sock_t* sock,  int level, int optname, const char * optval, int optlen) {
+    // more general options are handled by sock_setopt
+    net_err_t err = sock_setopt(sock, level, optname, optval, optlen);
+    if (err == NET_OK) {
+        return NET_OK;
+    } else if ((err < 0) && (err != NET_ERR_NOT_SUPPORT)) {
+        return err;
+    }
+    udp_t * udp = (udp_t *)sock;
+    if ((level == SOL_SOCKET) && (optname == SO_RCVBUF)) {
+        if ((optlen != sizeof(int)) || (*(int *)optval <= 0)) {
+            log_error(LOG_UDP, "param error");
+            return NET_ERR_PARAM;
+        }
+        udp->rcvbuf = *(int *)optval;
+        return NET_OK;
+    }
+    if (level != SOL_UDP) {
+        return NET_ERR_NOT_SUPPORT;
+    }
+    if (optlen != sizeof(int)) {
+        log_error(LOG_UDP, "param size error");
+        return NET_ERR_PARAM;
+    }
+    int value = *(int *)optval;
+    switch (optname) {
+        case UDP_SEGMENT:
+            if ((value < 0) || (value > UINT16_MAX - (int)sizeof(udp_hdr_t))) {
+                log_error(LOG_UDP, "segment size error: %d", value);
+                return NET_ERR_PARAM;
+            }
+            udp->gso_size = value;
+            return NET_OK;
+        case UDP_GRO:
+            udp->gro = value ? 1 : 0;
+            return NET_OK;
+        default:
+            log_error(LOG_UDP, "unknown param");
+            break;
+    }
+    return NET_ERR_PARAM;
+}
+
+
+static net_err_t udp_getopt(struct _sock_t* sock,  int level, int optname, char * optval, int * optlen) {
+    net_err_t err = sock_getopt(sock, level, optname, optval, optlen);
+    if (err == NET_OK) {
+        return NET_OK;
+    } else if ((err < 0) && (err != NET_ERR_NOT_SUPPORT)) {
+        return err;
+    }
+    udp_t * udp = (udp_t *)sock;
+    if ((level == SOL_UDP) && (optname == UDP_STATS)) {
+        if (*optlen < (int)sizeof(struct x_udp_stats)) {
+            log_error(LOG_UDP, "param size error");
+            return NET_ERR_PARAM;
+        }
+        struct x_udp_stats * stats = (struct x_udp_stats *)optval;
+        *stats = udp->stats;
+        stats->rcv_used = udp->rcv_used;
+        stats->rcvbuf = udp->rcvbuf;
+        *optlen = sizeof(struct x_udp_stats);
+        return NET_OK;
+    }
+    if ((level == SOL_SOCKET) && (optname == SO_RCVBUF)) {
+        if (*optlen < (int)sizeof(int)) {
+            log_error(LOG_UDP, "param size error");
+            return NET_ERR_PARAM;
+        }
+        *(int *)optval = udp->rcvbuf;
+        *optlen = sizeof(int);
+        return NET_OK;
+    }
+    if (level != SOL_UDP) {
+        return NET_ERR_NOT_SUPPORT;
+    }
+    if (*optlen < (int)sizeof(int)) {
+        log_error(LOG_UDP, "param size error");
+        return NET_ERR_PARAM;
+    }
+    switch (optname) {
+        case UDP_SEGMENT:
+            *(int *)optval = udp->gso_size;
+            break;
+        case UDP_GRO:
+            *(int *)optval = udp->gro;
+            break;
+        default:
+            log_error(LOG_UDP, "unknown param");
+            return NET_ERR_PARAM;
+    }
+    *optlen = sizeof(int);
+    return NET_OK;
+}
+
+
 net_err_t udp_close(sock_t* sock) {
     display_udp_list();
     udp_t * udp = (udp_t *)sock;
     list_remove(&udp_list, &sock->node);
+    udp_unhash(udp);
     list_node_t* node;
     while ((node = list_remove_first(&udp->recv_list))) {
         packet_t* buf = list_entry(node, packet_t, node);
         packet_free(buf);
     }
+    // the handles still lent become invalid with the socket
+    while ((node = list_remove_first(&udp->borrow_list))) {
+        packet_t* buf = list_entry(node, packet_t, node);
+        packet_free(buf);
+    }
     memory_pool_free(&udp_mblock, sock);
     return NET_OK;
 }
 
 net_err_t udp_connect(sock_t* sock, const struct x_sockaddr* addr, x_socklen_t len) {
     sock_connect(sock, addr, len);
+    udp_rehash((udp_t *)sock);
     display_udp_list();
     return NET_OK;
 }
 
 sock_t* udp_create(int family, int protocol) {
     static const sock_ops_t udp_ops = {
-            .setopt = sock_setopt,
+            .setopt = udp_setopt,
+            .getopt = udp_getopt,
             .sendto = udp_sendto,
             .recvfrom = udp_recvfrom,
             .close = udp_close,
@@ -253,6 +682,17 @@ sock_t* udp_create(int family, int protocol) {
         return (sock_t*)0;
     }
     init_list(&udp->recv_list);
+    init_list(&udp->borrow_list);
+    list_node_init(&udp->hash_node);
+    udp->bucket = (list_t *)0;
+    list_node_init(&udp->bind_node);
+    udp->bind_bucket = (list_t *)0;
+    udp->gso_size = 0;
+    udp->gro = 0;
+    udp->rcv_seg_size = 0;
+    udp->rcvbuf = UDP_RCVBUF_SIZE;
+    udp->rcv_used = 0;
+    plat_memset(&udp->stats, 0, sizeof(udp->stats));
     // only recv might needs to wait in udp
     udp->base.rcv_wait = &udp->rcv_wait;
     if (sock_wait_init(udp->base.rcv_wait) < 0) {
@@ -268,67 +708,91 @@ create_failed:
 
 
 net_err_t udp_out(ipaddr_t * dest, uint16_t dport, ipaddr_t * src, uint16_t sport, packet_t * buf) {
-    log_info(LOG_UDP, "send an udp packet!");
+    return udp_out_sum(dest, dport, src, sport, buf, (uint32_t *)0);
+}
 
-    // if the src is null, use the route table to find the src ip of interface
-    if (!src || ipaddr_is_any(src)) {
-        rentry_t* rt = rt_find(dest);
-        if (rt == (rentry_t*)0) {
-            dbg_dump_ip(LOG_UDP, "no route to dest: ", dest);
-            return NET_ERR_UNREACH;
-        }
-        src = &rt->netif->ipaddr;
+
+#define UDP_MATCH_NONE          0
+#define UDP_MATCH_ANY           1           // matched by a wildcard local ip
+#define UDP_MATCH_SPEC          2           // matched by a specific local ip
+
+/**
+ * how well a socket in the port table matches the datagram
+ */
+static int udp_port_match(sock_t * s, ipaddr_t* src_ip, uint16_t sport, ipaddr_t* dest_ip, uint16_t dport) {
+    if (s->local_port != dport) {
+        return UDP_MATCH_NONE;
     }
-    net_err_t err = packet_add_header(buf, sizeof(udp_hdr_t), 1);
-    if (err < 0) {
-        log_error(LOG_UDP, "add header failed. err = %d", err);
-        return NET_ERR_SIZE;
+    // partly connected, only one of remote ip and port is set
+    if (!ipaddr_is_any(&s->remote_ip) && !ipaddr_is_equal(&s->remote_ip, src_ip)) {
+        return UDP_MATCH_NONE;
     }
-
-    udp_hdr_t * udp_hdr = (udp_hdr_t*)packet_data(buf);
-    udp_hdr->src_port = sport;
-    udp_hdr->dest_port = dport;
-    udp_hdr->total_len = buf->total_size;
-    udp_hdr->src_port = e_htons(udp_hdr->src_port);
-    udp_hdr->dest_port = e_htons(udp_hdr->dest_port);
-    udp_hdr->total_len = e_htons(udp_hdr->total_len);
-    udp_hdr->checksum = checksum_peso(src->a_addr, dest->a_addr, NET_PROTOCOL_UDP, buf);
-    err = ipv4_out(NET_PROTOCOL_UDP, dest, src, buf);
-    if (err < 0) {
-        log_error(LOG_UDP, "udp out error, err = %d", err);
-        return err;
+    if (s->remote_port && (s->remote_port != sport)) {
+        return UDP_MATCH_NONE;
     }
-
-    return err;
+    if (ipaddr_is_any(&s->local_ip)) {
+        return UDP_MATCH_ANY;
+    }
+    return ipaddr_is_equal(&s->local_ip, dest_ip) ? UDP_MATCH_SPEC : UDP_MATCH_NONE;
 }
 
-static sock_t* udp_find(ipaddr_t* src_ip, uint16_t sport, ipaddr_t* dest_ip, uint16_t dport) {
-    // iterate allocated UDP sockets to find recipient
-    // local ip can be null, which means multiple netif can match
+
+/**
+ * connected sockets match the whole four-tuple and take priority, like Linux does
+ * then among the sockets bound to the port, a specific local ip wins over the wildcard
+ */
+static sock_t* udp_find(packet_t * buf, ipaddr_t* src_ip, uint16_t sport, ipaddr_t* dest_ip, uint16_t dport) {
+    if (!dport) {
+        return (sock_t *)0;
+    }
+
     list_node_t* node;
-    sock_t * found = (sock_t *)0;
-    list_for_each(node, &udp_list) {
-        sock_t* s = list_entry(node, sock_t, node);
-        // dst port must match
-        if (!dport || (s->local_port != dport)) {
+    list_for_each(node, udp_conn_hash + udp_conn_hashfn(dport, src_ip, sport)) {
+        sock_t * s = (sock_t *)list_entry(node, udp_t, hash_node);
+        if ((s->local_port != dport) || (s->remote_port != sport) || !ipaddr_is_equal(&s->remote_ip, src_ip)) {
             continue;
         }
-        // check if local_ip is null or equal to dest_ip, null means listens on all netifs
+        // local_ip can be null, which means multiple netif can match
         if (!ipaddr_is_any(&s->local_ip) && !ipaddr_is_equal(&s->local_ip, dest_ip)) {
             continue;
         }
-        // check if remote_ip is null or equal to src_ip
-        if (!ipaddr_is_any(&s->remote_ip) && !ipaddr_is_equal(&s->remote_ip, src_ip)) {
-            continue;
+        return s;
+    }
+
+    // a specific local ip is preferred over the wildcard, sockets sharing the port
+    // with SO_REUSEPORT on the preferred level are picked by the hash of the four-tuple
+    list_t * bucket = udp_port_hash + udp_port_hashfn(dport);
+    int spec_cnt = 0, any_cnt = 0;
+    list_for_each(node, bucket) {
+        switch (udp_port_match((sock_t *)list_entry(node, udp_t, hash_node), src_ip, sport, dest_ip, dport)) {
+            case UDP_MATCH_SPEC:
+                spec_cnt++;
+                break;
+            case UDP_MATCH_ANY:
+                any_cnt++;
+                break;
+            default:
+                break;
         }
-        // check if remote_port is null or equal to sport
-        if (s->remote_port && (s->remote_port != sport)) {
-            continue;
+    }
+    int level = spec_cnt ? UDP_MATCH_SPEC : UDP_MATCH_ANY;
+    int cnt = spec_cnt ? spec_cnt : any_cnt;
+    if (cnt == 0) {
+        return (sock_t *)0;
+    }
+    int pick = 0;
+    if (cnt > 1) {
+        // the hash is taken when the headers are parsed at ingress
+        uint32_t hash = (buf->hdr_flags & PACKET_HDR_L4) ? buf->flow_hash : sock_flow_hash(dest_ip, dport, src_ip, sport);
+        pick = (int)(hash % cnt);
+    }
+    list_for_each(node, bucket) {
+        sock_t * s = (sock_t *)list_entry(node, udp_t, hash_node);
+        if ((udp_port_match(s, src_ip, sport, dest_ip, dport) == level) && (pick-- == 0)) {
+            return s;
         }
-        found = s;
-        break;
     }
-    return found;
+    return (sock_t *)0;
 }
 
 static net_err_t is_pkt_ok(udp_pkt_t * pkt, int size) {
@@ -343,9 +807,10 @@ static net_err_t is_pkt_ok(udp_pkt_t * pkt, int size) {
 net_err_t udp_in (packet_t* buf, ipaddr_t* src_ip, ipaddr_t* dest_ip) {
     log_info(LOG_UDP, "Recv a udp packet!");
 
-    int iphdr_size = ipv4_hdr_size((ipv4_pkt_t *)packet_data(buf));
-    net_err_t err = packet_set_cont(buf, sizeof(udp_hdr_t) + iphdr_size);
-    if (err < 0) {
+    int iphdr_size = buf->l3_len;
+    net_err_t err;
+    // the header is continuous if it was parsed at ingress
+    if (!(buf->hdr_flags & PACKET_HDR_L4) && ((err = packet_set_cont(buf, sizeof(udp_hdr_t) + iphdr_size)) < 0)) {
         log_error(LOG_UDP, "set udp cont failed");
         return err;
     }
@@ -356,7 +821,7 @@ net_err_t udp_in (packet_t* buf, ipaddr_t* src_ip, ipaddr_t* dest_ip) {
     uint16_t remote_port = e_ntohs(udp_pkt->hdr.src_port);
 
     // find recipient socket
-    udp_t * udp = (udp_t*)udp_find(src_ip, remote_port, dest_ip, local_port);
+    udp_t * udp = (udp_t*)udp_find(buf, src_ip, remote_port, dest_ip, local_port);
     if (!udp) {
         log_error(LOG_UDP, "no udp for this packet");
         return NET_ERR_UNREACH;
@@ -366,17 +831,27 @@ net_err_t udp_in (packet_t* buf, ipaddr_t* src_ip, ipaddr_t* dest_ip) {
     udp_pkt = (udp_pkt_t*)packet_data(buf);
     if (udp_pkt->hdr.checksum) {
         packet_reset_pos(buf);
-        if (checksum_peso(dest_ip->a_addr, src_ip->a_addr, NET_PROTOCOL_UDP, buf)) {
+        if (checksum_peso_in(dest_ip->a_addr, src_ip->a_addr, NET_PROTOCOL_UDP, buf)) {
             log_warning(LOG_UDP, "udp check sum incorrect");
+            udp->stats.rcv_errors++;
             return NET_ERR_BROKEN;
         }
     }
+
+    // the datagram may wait long in the queue, don't keep the driver's buffer,
+    // and the header below is rewritten in place
+    if ((err = packet_detach(buf)) < 0) {
+        log_error(LOG_UDP, "detach failed");
+        udp->stats.rcv_errors++;
+        return err;
+    }
     udp_pkt = (udp_pkt_t*)(packet_data(buf));
     udp_pkt->hdr.src_port = e_ntohs(udp_pkt->hdr.src_port);
     udp_pkt->hdr.dest_port = e_ntohs(udp_pkt->hdr.dest_port);
     udp_pkt->hdr.total_len = e_ntohs(udp_pkt->hdr.total_len);
     if ((err = is_pkt_ok(udp_pkt, buf->total_size)) <  0) {
         log_error(LOG_UDP, "udp packet error");
+        udp->stats.rcv_errors++;
         return err;
     }
     display_udp_packet(udp_pkt);
@@ -388,12 +863,18 @@ net_err_t udp_in (packet_t* buf, ipaddr_t* src_ip, ipaddr_t* dest_ip) {
     from->port = remote_port;
     ipaddr_copy(&from->from, src_ip);
 
-    if (list_count(&udp->recv_list) < UDP_MAX_RECV) {
-        list_insert_last(&udp->recv_list, &buf->node);
-        sock_wakeup((sock_t *)udp, SOCK_WAIT_READ, NET_OK);
-    } else {
-        log_warning(LOG_UDP, "queue full, drop pkt");
+    // charge the memory actually used, an empty queue always takes one datagram
+    int footprint = packet_footprint(buf);
+    if (udp->rcv_used && (udp->rcv_used + footprint > udp->rcvbuf)) {
+        log_warning(LOG_UDP, "rcvbuf full, drop pkt");
+        udp->stats.rcv_buf_drops++;
         packet_free(buf);
+        return NET_OK;
     }
+    udp->rcv_used += footprint;
+    udp->stats.rcv_packets++;
+    udp->stats.rcv_bytes += buf->total_size - sizeof(udp_from_t);
+    list_insert_last(&udp->recv_list, &buf->node);
+    sock_wakeup((sock_t *)udp, SOCK_WAIT_READ, NET_OK);
     return NET_OK;
 }
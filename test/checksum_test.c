@@ -0,0 +1,118 @@
+#include "testcase.h"
+
+/**
+ * the plain 16-bit loop the kernels are checked against
+ * */
+static uint16_t checksum_ref(uint32_t offset, const uint8_t * buf, int len, uint32_t pre_sum) {
+    uint32_t sum = pre_sum;
+    for (int i = 0; i < len; i++) {
+        sum += ((offset + i) & 0x1) ? (uint32_t)buf[i] << 8 : buf[i];
+    }
+    while (sum >> 16) {
+        sum = (sum >> 16) + (sum & 0xffff);
+    }
+    return (uint16_t)sum;
+}
+
+void test_checksum() {
+    packet_buffer_init();
+    static uint8_t data[2048];
+    uint32_t seed = 0x12345678;
+    for (int i = 0; i < (int)sizeof(data); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+    // all ones stress the end-around carry
+    plat_memset(data + 1024, 0xFF, 512);
+
+    checksum_impl_t best = checksum_impl();
+    const char * names[] = {"generic", "sse2", "avx2"};
+    int errors = 0;
+    for (checksum_impl_t impl = CHECKSUM_GENERIC; impl <= CHECKSUM_AVX2; impl++) {
+        if (checksum_use(impl) < 0) {
+            printf("checksum %s: not supported\n", names[impl]);
+            continue;
+        }
+
+        // every start and length, odd offsets and a carried-in sum
+        for (int start = 0; start < 64; start++) {
+            for (int len = 0; len <= (int)sizeof(data) - 64; len++) {
+                uint32_t offset = start + len;
+                uint32_t pre_sum = (len & 0x1) ? 0xFFFF : len;
+                if (checksum16(offset, data + start, len, pre_sum, 0) != checksum_ref(offset, data + start, len, pre_sum)) {
+                    errors++;
+                }
+            }
+        }
+
+        // a packet made of odd sized pages, summed from odd positions
+        static const int chunks[] = {37, 128, 1, 255, 64, 3, 500, 2, 7};
+        packet_t * pkt = packet_alloc(0);
+        int total = 0;
+        for (int i = 0; i < (int)(sizeof(chunks) / sizeof(chunks[0])); i++) {
+            packet_add_ext(pkt, data + total, chunks[i]);
+            total += chunks[i];
+        }
+        for (int pos = 0; pos < 80; pos++) {
+            for (int size = 0; size <= total - pos; size += 13) {
+                packet_reset_pos(pkt);
+                packet_seek(pkt, pos);
+                if (packet_checksum16(pkt, size, 0, 0) != checksum_ref(0, data + pos, size, 0)) {
+                    errors++;
+                }
+            }
+        }
+        packet_free(pkt);
+        printf("checksum %s: %s\n", names[impl], errors ? "error" : "ok");
+    }
+
+    checksum_use(best);
+
+    // an incremental update gives the checksum of the changed data
+    int update_errors = 0;
+    uint16_t * words = (uint16_t *)data;
+    for (int i = 0; i < 4096; i++) {
+        uint16_t check = checksum16(0, data, 40, 0, 1);
+        seed = seed * 1103515245 + 12345;
+        uint16_t old_word = words[i % 20];
+        words[i % 20] = (i & 0x1) ? (uint16_t)(seed >> 16) : 0xFFFF - old_word;
+        if (checksum16_update(check, old_word, words[i % 20]) != checksum16(0, data, 40, 0, 1)) {
+            update_errors++;
+        }
+    }
+    printf("checksum update: %s\n", update_errors ? "error" : "ok");
+
+    // the sum taken while writing is the sum of what was written, at its place in the packet
+    int write_errors = 0;
+    for (int pos = 0; pos < 4; pos++) {
+        packet_t * wpkt = packet_alloc(333);
+        for (int i = 0; i < 3; i++) {
+            packet_join(wpkt, packet_alloc(489));
+        }
+        packet_reset_pos(wpkt);
+        packet_seek(wpkt, pos);
+        uint32_t data_sum = 0;
+        packet_write_csum(wpkt, data + 1, 701, &data_sum);
+        packet_write_csum(wpkt, data + 702, 1094, &data_sum);
+        if (data_sum != checksum_ref(pos, data + 1, 1795, 0)) {
+            write_errors++;
+        }
+        packet_free(wpkt);
+    }
+    printf("checksum write: %s\n", write_errors ? "error" : "ok");
+
+    // a deferred checksum completed after headers were added is the one summed in place
+    static const uint8_t src_ip[] = {10, 0, 0, 1}, dest_ip[] = {10, 0, 0, 2};
+    packet_t * seg = packet_alloc_headroom(999, 40);
+    packet_write(seg, data + 3, 999);
+    uint16_t * field = (uint16_t *)(packet_data(seg) + 16);
+    *field = 0;
+    uint16_t expect = checksum_peso(src_ip, dest_ip, 6, seg);
+    checksum_peso_defer(src_ip, dest_ip, 6, seg, field);
+    packet_add_header(seg, 20, 1);
+    packet_csum_finish(seg);
+    packet_remove_header(seg, 20);
+    int defer_ok = (*(uint16_t *)(packet_data(seg) + 16) == expect) && (seg->csum == PACKET_CSUM_NONE);
+    packet_free(seg);
+    printf("checksum defer: %s\n", defer_ok ? "ok" : "error");
+}
@@ -32,7 +32,7 @@ void show_help (void) {
 }
 
 int main (void) {
-    init_stack();
+    init_stack((net_config_t *)0);
     //test_timer();
     init_network_device();
     start_easy_net();
@@ -43,9 +43,18 @@ int main (void) {
     //test_logging();
     //test_list();
     //test_memory_pool();
+    //test_lf_pool();
     //test_msg_handler();
     //test_packet_buffer();
+    //test_checksum();
+    //test_tcp_buf();
+    //test_tcp_info();
+    //test_tcp_zc();
     //test_net_api();
+    //test_udp_gso();
+    //test_udp_recv_zc();
+    //test_udp_reuseport();
+    //test_udp_bind_conn();
 //    udp_echo_server_start(2000);
 //    udp_echo_client_start(friend0_ip, 1000);
     tcp_echo_client_start("192.168.74.3", 1200);
@@ -17,4 +17,109 @@ void test_memory_pool(){
     }
 
     memory_pool_destroy(&mem_pool);
+
+    // more blocks come from the arena once the static ones are taken, up to the limit
+    memory_pool_init_grow(&mem_pool, buffer, 100, 10, 50, LOCKER_NONE, 0);
+    void * grown[50];
+    int got = 0;
+    while ((got < 50) && (grown[got] = memory_pool_alloc(&mem_pool, -1))) {
+        got++;
+    }
+    printf("grow: %d blocks, over the limit: %p\n", got, memory_pool_alloc(&mem_pool, -1));
+    for (int i = 0; i < got; i++) {
+        memory_pool_free(&mem_pool, grown[i]);
+    }
+    memory_pool_destroy(&mem_pool);
+
+    // in huge pages if the system has some, see /sys/kernel/mm/hugepages/hugepages-2048kB/nr_hugepages
+    memory_pool_init_grow(&mem_pool, (void *)0, 4096, 0, 1024, LOCKER_NONE, MEM_ARENA_HUGE);
+    got = 0;
+    uint8_t * block;
+    while ((block = memory_pool_alloc(&mem_pool, -1))) {
+        plat_memset(block, got, 4096);
+        got++;
+    }
+    printf("huge: %d blocks in %s\n", got, mem_backing_name(mem_pool.arena.backing));
+    assert_halt(got == 1024, "huge pool short of blocks");
+    memory_pool_destroy(&mem_pool);
+}
+
+
+#define LF_TEST_THREADS     4
+#define LF_TEST_LOOPS       200000
+
+static uint8_t lf_buffer[64][32];
+static lf_pool_t lf_pool;
+static volatile int lf_done;
+static volatile int lf_errors;
+
+/**
+ * each thread takes a few blocks, stamps them with its id, checks nobody else got them and gives them back
+ * the even threads go through their own magazine
+ */
+static void lf_pool_worker(void * arg) {
+    int id = (int)(intptr_t)arg;
+    lf_cache_t cache = {.cnt = 0, .hits = 0};
+    void * blocks[4];
+    for (int n = 0; n < LF_TEST_LOOPS; n++) {
+        int got = 0;
+        while (got < 4) {
+            blocks[got] = (id & 1) ? lf_pool_alloc(&lf_pool, -1) : lf_cache_alloc(&lf_pool, &cache);
+            if (!blocks[got]) {
+                break;
+            }
+            *(volatile int *)((uint8_t *)blocks[got] + 8) = id;
+            got++;
+        }
+        for (int i = 0; i < got; i++) {
+            if (*(volatile int *)((uint8_t *)blocks[i] + 8) != id) {
+                sys_atomic_add(&lf_errors, 1);
+            }
+            if (id & 1) {
+                lf_pool_free(&lf_pool, blocks[i]);
+            } else {
+                lf_cache_free(&lf_pool, &cache, blocks[i]);
+            }
+        }
+    }
+    lf_cache_flush(&lf_pool, &cache);
+    sys_atomic_add(&lf_done, 1);
+}
+
+void test_lf_pool() {
+    lf_pool_init(&lf_pool, lf_buffer, sizeof(lf_buffer[0]), 64, 1);
+
+    // non-blocking alloc on an empty pool
+    void * temp[64];
+    for (int i = 0; i < 64; i++) {
+        temp[i] = lf_pool_alloc(&lf_pool, -1);
+    }
+    printf("empty pool alloc: %p, free count: %d\n", lf_pool_alloc(&lf_pool, -1), lf_pool_free_cnt(&lf_pool));
+    for (int i = 0; i < 64; i++) {
+        lf_pool_free(&lf_pool, temp[i]);
+    }
+
+    lf_done = lf_errors = 0;
+    for (int i = 0; i < LF_TEST_THREADS; i++) {
+        sys_thread_create(lf_pool_worker, (void *)(intptr_t)(i + 1));
+    }
+    while (lf_done < LF_TEST_THREADS) {
+        sys_sleep(10);
+    }
+    printf("lf pool: %d threads x %d loops, errors: %d, free count: %d/64, cache hits: %llu, misses: %llu\n",
+           LF_TEST_THREADS, LF_TEST_LOOPS, lf_errors, lf_pool_free_cnt(&lf_pool),
+           (unsigned long long)lf_pool.cache_hits, (unsigned long long)lf_pool.cache_misses);
+    lf_pool_destroy(&lf_pool);
+
+    // the same with a pool that starts with a few blocks and grows while the threads use it
+    lf_pool_init_grow(&lf_pool, sizeof(lf_buffer[0]), 4, 64, 1, 0, 0, 0);
+    lf_done = lf_errors = 0;
+    for (int i = 0; i < LF_TEST_THREADS; i++) {
+        sys_thread_create(lf_pool_worker, (void *)(intptr_t)(i + 1));
+    }
+    while (lf_done < LF_TEST_THREADS) {
+        sys_sleep(10);
+    }
+    printf("lf pool grow: errors: %d, free count: %d/%d\n", lf_errors, lf_pool_free_cnt(&lf_pool), lf_pool.cnt);
+    lf_pool_destroy(&lf_pool);
 }
@@ -1,6 +1,10 @@
 #include "packet_buffer.h"
 #include "sys_plat.h"
 
+static void ext_release(void * arg) {
+    (*(int *)arg)++;
+}
+
 void test_packet_buffer(){
     packet_buffer_init();
     static uint16_t temp[1000];
@@ -33,4 +37,108 @@ void test_packet_buffer(){
     for(int i = 0; i < 1000; i++){
         printf("%d ", read_temp[i]);
     }
-}
\ No newline at end of file
+
+    packet_free(pkt);
+
+    // external pages reference the caller's memory instead of copying it
+    packet_t * ext_pkt = packet_alloc(20);
+    packet_add_ext(ext_pkt, (uint8_t *)temp, 500);
+    packet_resize(ext_pkt, 530);
+    packet_add_header(ext_pkt, 14, CONTINUOUS);
+    packet_reset_pos(ext_pkt);
+    packet_seek(ext_pkt, 34);
+    plat_memset(read_temp, 0, sizeof(read_temp));
+    packet_read(ext_pkt, (uint8_t *)read_temp, 500);
+    for (int i = 0; i < 250; i++) {
+        if (read_temp[i] != temp[i]) {
+            printf("ext page error at %d\n", i);
+            break;
+        }
+    }
+    packet_free(ext_pkt);
+
+    // headers pushed into the headroom stay in the first page
+    packet_t * hr_pkt = packet_alloc_headroom(100, 42);
+    packet_add_header(hr_pkt, 8, CONTINUOUS);
+    packet_add_header(hr_pkt, 20, CONTINUOUS);
+    packet_add_header(hr_pkt, 14, CONTINUOUS);
+    printf("\nheadroom: pages %d, size %d\n", list_count(&hr_pkt->page_list), packet_total_size(hr_pkt));
+    packet_free(hr_pkt);
+
+    // a partial checksum follows the data when a header is added, and stays put when it fails
+    packet_t * csum_pkt = packet_alloc_headroom(100, 8);
+    csum_pkt->csum = PACKET_CSUM_PARTIAL;
+    csum_pkt->csum_start = 0;
+    packet_add_header(csum_pkt, 8, CONTINUOUS);
+    packet_add_header(csum_pkt, 20, CONTINUOUS);
+    int csum_ok = (csum_pkt->csum_start == 28);
+    csum_ok &= (packet_add_header(csum_pkt, PACKET_PAGE_BIG_SIZE + 1, CONTINUOUS) < 0) && (csum_pkt->csum_start == 28);
+    packet_free(csum_pkt);
+    printf("csum start: %s\n", csum_ok ? "ok" : "error");
+
+    // a clone shares the pages, the first write to shared data copies that page only
+    packet_t * orig = packet_alloc(1000);
+    packet_write(orig, (uint8_t *)temp, 1000);
+    packet_t * clone = packet_clone(orig, 100, 500);
+    uint8_t mark = 0xAA;
+    packet_write(clone, &mark, 1);
+    packet_reset_pos(orig);
+    packet_seek(orig, 100);
+    uint8_t orig_byte;
+    packet_read(orig, &orig_byte, 1);
+    packet_free(orig);
+    plat_memset(read_temp, 0, sizeof(read_temp));
+    packet_reset_pos(clone);
+    packet_read(clone, (uint8_t *)read_temp, 500);
+    int clone_ok = (orig_byte == ((uint8_t *)temp)[100]) && (((uint8_t *)read_temp)[0] == mark)
+            && !plat_memcmp((uint8_t *)read_temp + 1, (uint8_t *)temp + 101, 499);
+    printf("clone: %s\n", clone_ok ? "ok" : "error");
+    packet_free(clone);
+
+    // lent memory is given back once, after the packet and its clones stop using it
+    int released = 0;
+    packet_t * lent = packet_alloc_ext((uint8_t *)temp, 600, ext_release, &released);
+    packet_t * lent_clone = packet_clone(lent, 0, 300);
+    packet_free(lent);
+    int still_lent = (released == 0);
+    packet_detach(lent_clone);
+    packet_read(lent_clone, (uint8_t *)read_temp, 300);
+    int ext_ok = still_lent && (released == 1) && !plat_memcmp(read_temp, temp, 300);
+    packet_free(lent_clone);
+
+    // lent memory is read only, a header written in place only gets the header copied
+    lent = packet_alloc_ext((uint8_t *)temp, 600, ext_release, &released);
+    packet_set_cont(lent, 20);
+    packet_data(lent)[0] = (uint8_t)~temp[0];
+    ext_ok &= (*(uint8_t *)temp != packet_data(lent)[0]) && (packet_first_page(lent)->size == 20);
+    packet_free(lent);
+    ext_ok &= (released == 2);
+    printf("ext: %s\n", ext_ok ? "ok" : "error");
+
+    // seeks in any direction and spans read without the position land on the right bytes
+    packet_t * many = packet_alloc(0);
+    for (int i = 0; i < 40; i++) {
+        packet_add_ext(many, (uint8_t *)temp + i * 37, 37);
+    }
+    int seek_ok = 1;
+    for (int i = 0, off = 0; i < 200; i++) {
+        off = (off * 7 + 13) % many->total_size;
+        uint8_t byte;
+        packet_seek(many, off);
+        packet_read(many, &byte, 1);
+        seek_ok &= (byte == ((uint8_t *)temp)[off]);
+
+        packet_iter_t iter;
+        uint8_t * span;
+        int size, done = 0, count = (i * 11) % (many->total_size - off);
+        packet_iter_init(many, &iter, off, count);
+        while ((size = packet_iter_next(&iter, &span)) > 0) {
+            seek_ok &= !plat_memcmp(span, (uint8_t *)temp + off + done, size);
+            done += size;
+        }
+        seek_ok &= (done == count) && (many->pos == off + 1);
+    }
+    packet_free(many);
+    printf("seek: %s\n", seek_ok ? "ok" : "error");
+    packet_buffer_mem_stat();
+}
@@ -0,0 +1,83 @@
+#include "testcase.h"
+#include "socket.h"
+#include "tcp.h"
+#include "tcp_out.h"
+
+void test_tcp_info() {
+    // through the socket api, a new connection has no estimation yet
+    struct x_tcp_info info;
+    int sockfd = x_socket(AF_INET, SOCK_STREAM, 0);
+    int len = sizeof(info) - 1;
+    int short_err = x_getsockopt(sockfd, SOL_TCP, TCP_INFO, (char *)&info, &len);
+    len = sizeof(info);
+    int err = x_getsockopt(sockfd, SOL_TCP, TCP_INFO, (char *)&info, &len);
+    int api_ok = (short_err < 0) && (err == 0) && (len == (int)sizeof(info)) && (info.srtt == 0);
+    x_close(sockfd);
+    printf("tcp info api: %s\n", api_ok ? "ok" : "error");
+
+    // the first sample sets srtt, the later ones are smoothed, RFC 6298
+    static tcp_t tcp;
+    plat_memset(&tcp, 0, sizeof(tcp));
+    tcp_rtt_sample(&tcp, 100);
+    int first_ok = (tcp.snd.srtt == 100) && (tcp.snd.rttvar == 50);
+    tcp_rtt_sample(&tcp, 60);
+    len = sizeof(info);
+    err = tcp_getopt(&tcp.base, SOL_TCP, TCP_INFO, (char *)&info, &len);
+    int rtt_ok = first_ok && (err == NET_OK) && (info.srtt == 95) && (info.rttvar == 47);
+    printf("tcp info rtt: %s\n", rtt_ok ? "ok" : "error");
+}
+
+/**
+ * the id of the last send reported by TCP_ZEROCOPY_DONE, -1: none since the last call
+ */
+static int zc_done_last(tcp_t * tcp) {
+    struct x_zc_done done;
+    int len = sizeof(done);
+    tcp_getopt(&tcp->base, SOL_TCP, TCP_ZEROCOPY_DONE, (char *)&done, &len);
+    return done.cnt ? (int)done.hi : -1;
+}
+
+void test_tcp_zc() {
+    static uint8_t data[200];
+    static tcp_t tcp;
+    plat_memset(&tcp, 0, sizeof(tcp));
+    tcp_write_zc(&tcp, data, 100);
+    tcp_write_zc(&tcp, data + 100, 100);
+
+    // a segment in flight references the first send and half of the second one
+    packet_t * seg = packet_alloc(0);
+    int ref_len = tcp_zc_ref_data(&tcp, seg, 0, 150);
+
+    // acked, but the segment still points at the buffer
+    tcp_snd_remove(&tcp, 100);
+    int acked_in_use = zc_done_last(&tcp);
+
+    // completed once the segment is freed, the second send is not acked yet
+    packet_free(seg);
+    int freed = zc_done_last(&tcp);
+
+    tcp_snd_remove(&tcp, 100);
+    int acked = zc_done_last(&tcp);
+    tcp_zc_free(&tcp);
+
+    int ok = (ref_len == 150) && (acked_in_use == -1) && (freed == 0) && (acked == 1);
+    printf("tcp zero-copy completion: %s\n", ok ? "ok" : "error");
+
+    // a segment put on the out queue of a netif still points at the user buffer
+    static netif_t netif;
+    plat_memset(&netif, 0, sizeof(netif));
+    fixed_queue_init(&netif.out_q, netif.out_q_buf, NETIF_OUTQ_SIZE, LOCKER_THREAD);
+    plat_memset(&tcp, 0, sizeof(tcp));
+    tcp_write_zc(&tcp, data, 100);
+    seg = packet_alloc(0);
+    tcp_zc_ref_data(&tcp, seg, 0, 100);
+    netif_put_out(&netif, seg, -1);
+    packet_t * out = (packet_t *)fixed_queue_recv(&netif.out_q, -1);
+    int out_ok = (out == seg) && (packet_first_page(out)->data == data);
+    packet_free(out);
+    tcp_snd_remove(&tcp, 100);
+    out_ok = out_ok && (zc_done_last(&tcp) == 0);
+    tcp_zc_free(&tcp);
+    fixed_queue_destroy(&netif.out_q);
+    printf("tcp zero-copy out: %s\n", out_ok ? "ok" : "error");
+}
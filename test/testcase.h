@@ -13,6 +13,7 @@ void test_list();
 
 #include "memory_pool.h"
 void test_memory_pool();
+void test_lf_pool();
 
 #include "msg_handler.h"
 void test_msg_handler();
@@ -20,6 +21,9 @@ void test_msg_handler();
 #include "packet_buffer.h"
 void test_packet_buffer();
 
+#include "utils.h"
+void test_checksum();
+
 #include "timer.h"
 void test_timer();
 
@@ -29,8 +33,16 @@ void test_arp(netif_t * netif);
 #include "ipv4.h"
 void test_ipv4();
 
+void test_tcp_buf();
+void test_tcp_info();
+void test_tcp_zc();
+
 //#include "net_api.h"
 void test_net_api();
+void test_udp_gso();
+void test_udp_recv_zc();
+void test_udp_reuseport();
+void test_udp_bind_conn();
 
 
 void download_test (const char * filename, int port);
@@ -0,0 +1,160 @@
+#include "testcase.h"
+#include "net_api.h"
+
+#define UDP_TEST_PORT       5000
+
+void test_udp_gso() {
+    static uint8_t data[350], recv_buf[1024];
+    for (int i = 0; i < (int)sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+
+    struct x_sockaddr_in addr;
+    plat_memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = e_htons(UDP_TEST_PORT);
+    x_inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    int rx = x_socket(AF_INET, SOCK_DGRAM, 0);
+    x_bind(rx, (struct x_sockaddr *)&addr, sizeof(addr));
+    int on = 1;
+    x_setsockopt(rx, SOL_UDP, UDP_GRO, (const char *)&on, sizeof(on));
+
+    // 350 bytes leave as datagrams of 100, 100, 100 and 50 bytes
+    int tx = x_socket(AF_INET, SOCK_DGRAM, 0);
+    int seg_size = 100;
+    x_setsockopt(tx, SOL_UDP, UDP_SEGMENT, (const char *)&seg_size, sizeof(seg_size));
+    ssize_t sent = x_sendto(tx, data, sizeof(data), 0, (struct x_sockaddr *)&addr, sizeof(addr));
+
+    // let the loopback deliver all of them, then they are read back as one
+    sys_sleep(100);
+    struct x_sockaddr_in from;
+    struct x_mmsghdr msg = {
+        .buf = recv_buf,
+        .len = sizeof(recv_buf),
+        .addr = (struct x_sockaddr *)&from,
+        .addr_len = sizeof(from),
+    };
+    int cnt = x_recvmmsg(rx, &msg, 1, 0);
+    int ok = (sent == (ssize_t)sizeof(data)) && (cnt == 1) && (msg.msg_len == (ssize_t)sizeof(data))
+            && (msg.seg_size == seg_size) && !plat_memcmp(recv_buf, data, sizeof(data));
+    printf("udp segment and gro: %s\n", ok ? "ok" : "error");
+    x_close(tx);
+    x_close(rx);
+}
+
+void test_udp_recv_zc() {
+    static uint8_t data[64];
+    plat_memset(data, 0x5A, sizeof(data));
+
+    struct x_sockaddr_in addr;
+    plat_memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = e_htons(UDP_TEST_PORT + 1);
+    x_inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    int rx = x_socket(AF_INET, SOCK_DGRAM, 0);
+    x_bind(rx, (struct x_sockaddr *)&addr, sizeof(addr));
+    int other = x_socket(AF_INET, SOCK_DGRAM, 0);
+    int tx = x_socket(AF_INET, SOCK_DGRAM, 0);
+    x_sendto(tx, data, sizeof(data), 0, (struct x_sockaddr *)&addr, sizeof(addr));
+
+    struct x_iovec iov[4];
+    int iovcnt = 4;
+    struct x_sockaddr_in from;
+    x_socklen_t from_len = sizeof(from);
+    void * handle = (void *)0;
+    ssize_t size = x_recvfrom_zc(rx, iov, &iovcnt, (struct x_sockaddr *)&from, &from_len, &handle);
+    int data_ok = (size == (ssize_t)sizeof(data)) && (iovcnt >= 1) && !plat_memcmp(iov[0].iov_base, data, iov[0].iov_len);
+
+    // only the socket that lent a datagram takes it back, and only once
+    void * copy = handle;
+    int wrong_sock = x_recv_release(other, &copy, 1);
+    int released = x_recv_release(rx, &copy, 1);
+    copy = handle;
+    int twice = x_recv_release(rx, &copy, 1);
+    int ok = data_ok && (wrong_sock < 0) && (released == 0) && (twice < 0);
+    printf("udp zero-copy receive release: %s\n", ok ? "ok" : "error");
+    x_close(tx);
+    x_close(other);
+    x_close(rx);
+}
+
+#define REUSE_TEST_FLOWS    6           // with the two receivers, within SOCKET_MAX_NR
+
+void test_udp_reuseport() {
+    struct x_sockaddr_in addr;
+    plat_memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = e_htons(UDP_TEST_PORT + 2);
+    x_inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    // two sockets share the port
+    int rx[2];
+    int on = 1;
+    struct x_timeval tmo = {.tv_sec = 0, .tv_usec = 100000};
+    for (int i = 0; i < 2; i++) {
+        rx[i] = x_socket(AF_INET, SOCK_DGRAM, 0);
+        x_setsockopt(rx[i], SOL_SOCKET, SO_REUSEPORT, (const char *)&on, sizeof(on));
+        x_setsockopt(rx[i], SOL_SOCKET, SO_RCVTIMEO, (const char *)&tmo, sizeof(tmo));
+        x_bind(rx[i], (struct x_sockaddr *)&addr, sizeof(addr));
+    }
+
+    // each flow sends twice, from its own port
+    int tx[REUSE_TEST_FLOWS];
+    for (int i = 0; i < REUSE_TEST_FLOWS; i++) {
+        tx[i] = x_socket(AF_INET, SOCK_DGRAM, 0);
+        uint8_t flow = (uint8_t)i;
+        x_sendto(tx[i], &flow, 1, 0, (struct x_sockaddr *)&addr, sizeof(addr));
+        x_sendto(tx[i], &flow, 1, 0, (struct x_sockaddr *)&addr, sizeof(addr));
+    }
+
+    // a flow always lands on the same socket, and the flows are spread over both
+    int owner[REUSE_TEST_FLOWS], got[2] = {0, 0}, errors = 0;
+    for (int i = 0; i < REUSE_TEST_FLOWS; i++) {
+        owner[i] = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        uint8_t flow;
+        struct x_sockaddr_in from;
+        x_socklen_t from_len = sizeof(from);
+        while (x_recvfrom(rx[i], &flow, 1, 0, (struct x_sockaddr *)&from, &from_len) == 1) {
+            if ((flow >= REUSE_TEST_FLOWS) || ((owner[flow] >= 0) && (owner[flow] != i))) {
+                errors++;
+                continue;
+            }
+            owner[flow] = i;
+            got[i]++;
+        }
+    }
+    int ok = !errors && (got[0] + got[1] == 2 * REUSE_TEST_FLOWS) && got[0] && got[1];
+    printf("udp reuseport: %d/%d datagrams, %s\n", got[0], got[1], ok ? "ok" : "error");
+    for (int i = 0; i < REUSE_TEST_FLOWS; i++) {
+        x_close(tx[i]);
+    }
+    x_close(rx[0]);
+    x_close(rx[1]);
+}
+
+/**
+ * a connected socket still holds its local ip-port pair, another socket can't bind it
+ */
+void test_udp_bind_conn() {
+    struct x_sockaddr_in local, remote;
+    plat_memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = e_htons(UDP_TEST_PORT + 3);
+    x_inet_pton(AF_INET, "127.0.0.1", &local.sin_addr);
+    remote = local;
+    remote.sin_port = e_htons(UDP_TEST_PORT + 4);
+
+    int conn = x_socket(AF_INET, SOCK_DGRAM, 0);
+    int bind_ok = x_bind(conn, (struct x_sockaddr *)&local, sizeof(local)) == 0;
+    int conn_ok = x_connect(conn, (struct x_sockaddr *)&remote, sizeof(remote)) == 0;
+
+    int other = x_socket(AF_INET, SOCK_DGRAM, 0);
+    int rebind_failed = x_bind(other, (struct x_sockaddr *)&local, sizeof(local)) < 0;
+    printf("udp bind connected: %s\n", (bind_ok && conn_ok && rebind_failed) ? "ok" : "error");
+    x_close(other);
+    x_close(conn);
+}